@@ -0,0 +1,43 @@
+#include "../src/histogram.h"
+
+#include <random>
+
+/*
+Compare the scalar and AVX2 histogram kernels on display sized and full
+resolution frames of random pixels. Usage: histogram_bench [iterations]
+*/
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? std::max(1, std::atoi(argv[1])) : 50;
+
+    std::mt19937 random(42);
+    for (QSize size : {QSize(2560, 1440), QSize(8192, 5464)}) {
+        QImage image(size, QImage::Format_RGB32);
+        for (int y = 0; y < image.height(); ++y) {
+            auto* pixels = reinterpret_cast<uint32_t*>(image.scanLine(y));
+            for (int x = 0; x < image.width(); ++x) pixels[x] = static_cast<uint32_t>(random());
+        }
+
+        auto measure = [&](auto kernel) {
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < iterations; ++i) kernel(image);
+            std::chrono::duration<double, std::milli> elapsed =
+                std::chrono::steady_clock::now() - start;
+            return elapsed.count() / iterations;
+        };
+
+        double scalar = measure(Histogram::compute_scalar);
+        std::cout << size.width() << "x" << size.height()
+                  << "  scalar " << scalar << " ms";
+
+        if (Histogram::has_avx2()) {
+            if (Histogram::compute_avx2(image) != Histogram::compute_scalar(image)) {
+                std::cerr << "\nAVX2 kernel disagrees with the scalar kernel\n";
+                return 1;
+            }
+            double avx2 = measure(Histogram::compute_avx2);
+            std::cout << "  avx2 " << avx2 << " ms  (" << scalar / avx2 << "x)";
+        }
+        std::cout << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,423 @@
+#include "../src/application.h"
+
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+
+#include <fstream>
+#include <random>
+#include <sys/resource.h>
+
+/*
+End to end navigation benchmark: runs the real Application on the offscreen
+platform over a generated corpus and replays a fixed script of arrow keys,
+window resizes and panel edits, timing each step up to the paint that
+finishes it. Prints JSON with the latency distributions, the per stage
+histograms, peak RSS and how much was read.
+
+Usage: replay_bench [--corpus DIR] [--files N] [--steps N] [--size WxH]
+                    [--output PATH]
+Without --corpus a temporary corpus of JPEGs and HEICs is generated, with
+camera, capture time, exposure, GPS and orientation tags and an Exif
+thumbnail, like photos straight off a phone or camera. A given corpus is
+copied to a temporary directory first, since the edits write to the files;
+the copy leaves it in the page cache, so reads are warm either way.
+*/
+
+namespace {
+
+struct Options {
+    QString corpus;
+    int files = 60;
+    int steps = 200;
+    QSize size{3000, 2000};
+    QString output;
+};
+
+struct Camera {
+    const char* make;
+    const char* model;
+};
+
+const Camera CAMERAS[] = {
+    {"Canon", "Canon EOS R5"},
+    {"SONY", "ILCE-7M4"},
+    {"Apple", "iPhone 15 Pro"},
+};
+
+QImage synthesize(const QSize& size, std::mt19937& random) {
+    // Smooth gradients plus noise compress like real photos, unlike flat
+    // colour or pure noise
+    QImage image(size, QImage::Format_RGB32);
+    std::uniform_int_distribution<int> noise(-12, 12);
+    int hue = static_cast<int>(random() % 360);
+    for (int y = 0; y < image.height(); ++y) {
+        auto* pixels = reinterpret_cast<QRgb*>(image.scanLine(y));
+        for (int x = 0; x < image.width(); ++x) {
+            QColor color = QColor::fromHsv(
+                (hue + x * 120 / image.width()) % 360,
+                80 + y * 150 / image.height(),
+                200
+            );
+            pixels[x] = qRgb(
+                std::clamp(color.red() + noise(random), 0, 255),
+                std::clamp(color.green() + noise(random), 0, 255),
+                std::clamp(color.blue() + noise(random), 0, 255)
+            );
+        }
+    }
+    return image;
+}
+
+Exiv2::ExifData make_exif(int index, const QImage& image, std::mt19937& random) {
+    const Camera& camera = CAMERAS[index % std::size(CAMERAS)];
+    std::uniform_real_distribution<double> offset(-0.5, 0.5);
+
+    Exiv2::ExifData exif_data;
+    exif_data["Exif.Image.Make"] = camera.make;
+    exif_data["Exif.Image.Model"] = camera.model;
+    exif_data["Exif.Image.ImageDescription"] = "Replay corpus image " + std::to_string(index);
+    // Every seventh is a portrait shot held sideways
+    exif_data["Exif.Image.Orientation"] = static_cast<uint16_t>(index % 7 == 3 ? 6 : 1);
+    exif_data["Exif.Photo.DateTimeOriginal"] = QDateTime(QDate(2024, 6, 1), QTime(9, 0))
+        .addSecs(index * 97)
+        .toString("yyyy:MM:dd HH:mm:ss")
+        .toStdString();
+    const auto step = static_cast<uint32_t>(index);
+    exif_data["Exif.Photo.ExposureTime"] = Exiv2::URational(1u, 125u << (step % 4));
+    exif_data["Exif.Photo.FNumber"] = Exiv2::URational(28u + 10u * (step % 5), 10u);
+    exif_data["Exif.Photo.FocalLength"] = Exiv2::URational(24u + 11u * (step % 7), 1u);
+    exif_data["Exif.Photo.ISOSpeedRatings"] = static_cast<uint16_t>(100 << (index % 5));
+    exif_data["Exif.Photo.PixelXDimension"] = static_cast<uint32_t>(image.width());
+    exif_data["Exif.Photo.PixelYDimension"] = static_cast<uint32_t>(image.height());
+
+    // A few clusters of shots around cities, as a trip would produce
+    const double cities[][2] = {{47.6, -122.3}, {48.86, 2.35}, {35.68, 139.69}};
+    double latitude = cities[index % 3][0] + offset(random);
+    double longitude = cities[index % 3][1] + offset(random);
+    auto dms = [](double value) {
+        value = std::abs(value);
+        int degrees = static_cast<int>(value);
+        int minutes = static_cast<int>((value - degrees) * 60);
+        int seconds = static_cast<int>(((value - degrees) * 60 - minutes) * 60 * 100);
+        return std::to_string(degrees) + "/1 " + std::to_string(minutes) + "/1 " +
+            std::to_string(seconds) + "/100";
+    };
+    exif_data["Exif.GPSInfo.GPSLatitudeRef"] = latitude >= 0 ? "N" : "S";
+    exif_data["Exif.GPSInfo.GPSLatitude"] = dms(latitude);
+    exif_data["Exif.GPSInfo.GPSLongitudeRef"] = longitude >= 0 ? "E" : "W";
+    exif_data["Exif.GPSInfo.GPSLongitude"] = dms(longitude);
+    return exif_data;
+}
+
+bool write_jpeg(const QString& path, const QImage& image, Exiv2::ExifData exif_data) {
+    if (!image.save(path, "JPG", 90)) return false;
+
+    QByteArray thumbnail;
+    QBuffer buffer(&thumbnail);
+    buffer.open(QIODevice::WriteOnly);
+    image.scaled(160, 120, Qt::KeepAspectRatio, Qt::SmoothTransformation)
+        .save(&buffer, "JPG", 80);
+    Exiv2::ExifThumb(exif_data).setJpegThumbnail(
+        reinterpret_cast<const Exiv2::byte*>(thumbnail.constData()),
+        static_cast<size_t>(thumbnail.size())
+    );
+
+    auto file = Exiv2::ImageFactory::open(path.toStdString());
+    file->setExifData(exif_data);
+    file->writeMetadata();
+    return true;
+}
+
+bool write_heic(const QString& path, const QImage& source, const Exiv2::ExifData& exif_data) {
+    heif_context* context = heif_context_alloc();
+    heif_encoder* encoder = nullptr;
+    heif_error error = heif_context_get_encoder_for_format(
+        context, heif_compression_HEVC, &encoder
+    );
+    if (error.code != heif_error_Ok) {
+        heif_context_free(context);
+        return false;
+    }
+    heif_encoder_set_lossy_quality(encoder, 80);
+
+    QImage image = source.convertToFormat(QImage::Format_RGB888);
+    heif_image* picture = nullptr;
+    heif_image_create(
+        image.width(), image.height(), heif_colorspace_RGB,
+        heif_chroma_interleaved_RGB, &picture
+    );
+    heif_image_add_plane(
+        picture, heif_channel_interleaved, image.width(), image.height(), 8
+    );
+    int stride = 0;
+    uint8_t* plane = heif_image_get_plane(picture, heif_channel_interleaved, &stride);
+    for (int y = 0; y < image.height(); ++y) {
+        std::memcpy(
+            plane + static_cast<ptrdiff_t>(y) * stride,
+            image.constScanLine(y),
+            static_cast<size_t>(image.width()) * 3
+        );
+    }
+
+    heif_image_handle* handle = nullptr;
+    error = heif_context_encode_image(context, picture, encoder, nullptr, &handle);
+    if (error.code == heif_error_Ok) {
+        // HEIC carries its orientation in the container, so the Exif tag is
+        // informational only, as with phone photos
+        Exiv2::Blob blob;
+        Exiv2::ExifParser::encode(blob, Exiv2::littleEndian, exif_data);
+        heif_context_add_exif_metadata(
+            context, handle, blob.data(), static_cast<int>(blob.size())
+        );
+        error = heif_context_write_to_file(context, path.toUtf8().constData());
+        heif_image_handle_release(handle);
+    }
+
+    heif_image_release(picture);
+    heif_encoder_release(encoder);
+    heif_context_free(context);
+    return error.code == heif_error_Ok;
+}
+
+std::pair<int, int> generate(const QString& directory, const Options& options) {
+    std::mt19937 random(7);
+    int jpegs = 0;
+    int heics = 0;
+    bool heic_supported = true;
+
+    for (int i = 0; i < options.files; ++i) {
+        QImage image = synthesize(options.size, random);
+        Exiv2::ExifData exif_data = make_exif(i, image, random);
+        QString base = QDir(directory).filePath(QString("IMG_%1").arg(i, 4, 10, QChar('0')));
+
+        // Every fifth file is HEIC, when libheif has an HEVC encoder
+        if (i % 5 == 4 && heic_supported) {
+            heic_supported = write_heic(base + ".heic", image, exif_data);
+            if (heic_supported) {
+                heics++;
+                continue;
+            }
+        }
+        if (write_jpeg(base + ".jpg", image, exif_data)) jpegs++;
+    }
+    return {jpegs, heics};
+}
+
+// The edit phases write into the files, so a given corpus is replayed from
+// a copy and the originals are never touched
+std::pair<int, int> copy_corpus(const QString& source, const QString& directory) {
+    int jpegs = 0;
+    int heics = 0;
+    QDir root(source);
+    QDirIterator it(source, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        QString path = it.next();
+        QString target = QDir(directory).filePath(root.relativeFilePath(path));
+        QDir().mkpath(QFileInfo(target).absolutePath());
+        if (!QFile::copy(path, target)) continue;
+
+        QString suffix = QFileInfo(path).suffix().toLower();
+        if (suffix == "jpg" || suffix == "jpeg") jpegs++;
+        else if (suffix == "heic") heics++;
+    }
+    return {jpegs, heics};
+}
+
+void pump(int milliseconds) {
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < milliseconds) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 5);
+    }
+}
+
+// Process events until the navigation histogram gains a sample, meaning the
+// new image reached a paint
+bool wait_for_paint(uint64_t before, int timeout) {
+    QElapsedTimer timer;
+    timer.start();
+    while (Stats::histogram(Stats::Stage::NAVIGATE).count() == before) {
+        if (timer.elapsed() > timeout) return false;
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 5);
+    }
+    return true;
+}
+
+uint64_t microseconds_since(std::chrono::steady_clock::time_point start) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start
+    ).count());
+}
+
+uint64_t proc_io(const std::string& field) {
+    std::ifstream stream("/proc/self/io");
+    std::string name;
+    uint64_t value;
+    while (stream >> name >> value) {
+        if (name == field + ":") return value;
+    }
+    return 0;
+}
+
+void write_histogram(std::ostream& stream, const Stats::Histogram& histogram) {
+    stream << "{\"count\":" << histogram.count()
+           << ",\"mean\":" << histogram.mean()
+           << ",\"p50\":" << histogram.percentile(50)
+           << ",\"p90\":" << histogram.percentile(90)
+           << ",\"p99\":" << histogram.percentile(99)
+           << ",\"max\":" << histogram.max() << "}";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        if (flag == "--corpus") options.corpus = argv[i + 1];
+        else if (flag == "--files") options.files = std::max(2, std::atoi(argv[i + 1]));
+        else if (flag == "--steps") options.steps = std::max(1, std::atoi(argv[i + 1]));
+        else if (flag == "--output") options.output = argv[i + 1];
+        else if (flag == "--size") {
+            QStringList parts = QString(argv[i + 1]).split('x');
+            if (parts.size() == 2) options.size = QSize(parts[0].toInt(), parts[1].toInt());
+        }
+        else {
+            std::cerr << "Unknown option " << flag << "\n";
+            return 1;
+        }
+    }
+
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+    Trace::init();
+    Trace::set_thread_name("GUI");
+
+    QTemporaryDir temporary;
+    int jpegs = 0;
+    int heics = 0;
+    if (options.corpus.isEmpty()) {
+        options.corpus = temporary.path();
+        std::tie(jpegs, heics) = generate(temporary.path(), options);
+        std::cerr << "Generated " << jpegs << " JPEG and " << heics << " HEIC files\n";
+    }
+    else {
+        std::tie(jpegs, heics) = copy_corpus(options.corpus, temporary.path());
+        std::cerr << "Copied " << jpegs << " JPEG and " << heics << " HEIC files\n";
+    }
+
+    // Generation must not count towards the measurements
+    for (size_t i = 0; i < static_cast<size_t>(Stats::Stage::COUNT); ++i) {
+        Stats::histogram(static_cast<Stats::Stage>(i)).reset();
+    }
+    uint64_t bytes_before = proc_io("rchar");
+
+    auto startup = std::chrono::steady_clock::now();
+    QByteArray folder = temporary.path().toUtf8();
+    // Held by pointer so it can be destroyed before the shared pool stops
+    auto application = std::make_unique<Application>(folder.constData());
+    application->resize(1280, 800);
+    application->show();
+    // Key events only reach the navigation while the window is active
+    application->activateWindow();
+
+    // The folder streams in; the first panel marks the first image on screen
+    QElapsedTimer timer;
+    timer.start();
+    while (Stats::histogram(Stats::Stage::PANEL).count() == 0 && timer.elapsed() < 30000) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 5);
+    }
+    uint64_t first_image = microseconds_since(startup);
+    pump(500);
+
+    // 20 step cycle: mostly forward, some back, two resizes and two edits
+    Stats::Histogram keypress;
+    Stats::Histogram resize;
+    Stats::Histogram edit;
+    int timeouts = 0;
+    const QSize sizes[] = {QSize(1600, 1000), QSize(1280, 800)};
+
+    for (int step = 0; step < options.steps; ++step) {
+        int phase = step % 20;
+        auto start = std::chrono::steady_clock::now();
+
+        if (phase == 9 || phase == 19) {
+            application->resize(sizes[phase == 19 ? 1 : 0]);
+            QCoreApplication::processEvents();
+            resize.record(microseconds_since(start));
+        }
+        else if (phase == 4 || phase == 14) {
+            // Panel edits write through refresh_metadata as they are typed
+            QTextEdit* target = nullptr;
+            for (QTextEdit* text_edit : application->findChildren<QTextEdit*>()) {
+                if (text_edit->isVisible() && !text_edit->isReadOnly()) {
+                    target = text_edit;
+                    break;
+                }
+            }
+            if (!target) continue;
+            target->setPlainText(QString("Replay edit %1").arg(step));
+            edit.record(microseconds_since(start));
+        }
+        else {
+            Qt::Key key = phase >= 15 ? Qt::Key_Left : Qt::Key_Right;
+            uint64_t before = Stats::histogram(Stats::Stage::NAVIGATE).count();
+
+            QKeyEvent press(QEvent::KeyPress, key, Qt::NoModifier);
+            QCoreApplication::sendEvent(application.get(), &press);
+            QKeyEvent release(QEvent::KeyRelease, key, Qt::NoModifier);
+            QCoreApplication::sendEvent(application.get(), &release);
+
+            if (wait_for_paint(before, 10000)) {
+                keypress.record(microseconds_since(start));
+            } else {
+                timeouts++;
+            }
+        }
+    }
+    // Let the last write and background work settle before reading RSS
+    pump(200);
+
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+
+    std::ostringstream json;
+    json << "{\"unit\":\"us\""
+         << ",\"corpus\":{\"path\":\"" << options.corpus.toStdString() << "\""
+         << ",\"jpeg\":" << jpegs << ",\"heic\":" << heics << "}"
+         << ",\"steps\":" << options.steps
+         << ",\"timeouts\":" << timeouts
+         << ",\"first_image\":" << first_image
+         << ",\"keypress_to_paint\":";
+    write_histogram(json, keypress);
+    json << ",\"resize\":";
+    write_histogram(json, resize);
+    json << ",\"edit\":";
+    write_histogram(json, edit);
+    json << ",\"stages\":{";
+    for (size_t i = 0; i < static_cast<size_t>(Stats::Stage::COUNT); ++i) {
+        if (i > 0) json << ",";
+        auto stage = static_cast<Stats::Stage>(i);
+        json << "\"" << Stats::stage_name(stage) << "\":";
+        write_histogram(json, Stats::histogram(stage));
+    }
+    json << "}"
+         // ru_maxrss is in kilobytes on Linux
+         << ",\"peak_rss_kb\":" << usage.ru_maxrss
+         << ",\"files_read\":" << Stats::histogram(Stats::Stage::READ).count()
+         << ",\"bytes_read\":" << proc_io("rchar") - bytes_before
+         << "}\n";
+
+    if (options.output.isEmpty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream(options.output.toStdString()) << json.str();
+    }
+
+    application.reset();
+    stop_exiftool();
+    Scheduler::shutdown();
+    ReadAhead::shutdown();
+    Trace::finish();
+    return timeouts == 0 ? 0 : 1;
+}
@@ -0,0 +1,163 @@
+#include "allocations.h"
+
+#if ENABLE_ALLOCATION_TRACKING
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+namespace Allocations {
+
+namespace {
+
+const size_t SLOTS = static_cast<size_t>(Stats::Stage::COUNT) + 1;
+
+// Plain arrays of atomics are constant initialized, so they are usable by
+// allocations made before main and during static initialization
+std::atomic<uint64_t> allocation_counts[SLOTS];
+std::atomic<uint64_t> allocation_bytes[SLOTS];
+std::atomic<uint64_t> copy_counts[SLOTS];
+std::atomic<uint64_t> copy_bytes[SLOTS];
+
+thread_local Totals thread_local_totals;
+
+void count_allocation(size_t size) {
+    size_t slot = static_cast<size_t>(Stats::current_stage());
+    allocation_counts[slot].fetch_add(1, std::memory_order_relaxed);
+    allocation_bytes[slot].fetch_add(size, std::memory_order_relaxed);
+    thread_local_totals.allocations++;
+    thread_local_totals.bytes += size;
+}
+
+void* allocate(size_t size) {
+    count_allocation(size);
+    // malloc(0) may return null, which new must not
+    void* pointer = std::malloc(size ? size : 1);
+    if (!pointer) throw std::bad_alloc();
+    return pointer;
+}
+
+void* allocate_aligned(size_t size, std::align_val_t alignment) {
+    count_allocation(size);
+    size_t align = static_cast<size_t>(alignment);
+    // aligned_alloc wants a multiple of the alignment
+    size_t rounded = (std::max(size, size_t{1}) + align - 1) / align * align;
+    void* pointer = std::aligned_alloc(align, rounded);
+    if (!pointer) throw std::bad_alloc();
+    return pointer;
+}
+
+}  // namespace
+
+void copied(size_t bytes) {
+    size_t slot = static_cast<size_t>(Stats::current_stage());
+    copy_counts[slot].fetch_add(1, std::memory_order_relaxed);
+    copy_bytes[slot].fetch_add(bytes, std::memory_order_relaxed);
+    thread_local_totals.copies++;
+    thread_local_totals.copied_bytes += bytes;
+}
+
+Totals totals(Stats::Stage stage) {
+    size_t slot = static_cast<size_t>(stage);
+    return {
+        allocation_counts[slot].load(std::memory_order_relaxed),
+        allocation_bytes[slot].load(std::memory_order_relaxed),
+        copy_counts[slot].load(std::memory_order_relaxed),
+        copy_bytes[slot].load(std::memory_order_relaxed)
+    };
+}
+
+Totals thread_totals() {
+    return thread_local_totals;
+}
+
+Navigation& navigation() {
+    static Navigation instance;
+    return instance;
+}
+
+void navigated(const Totals& delta) {
+    Navigation& histograms = navigation();
+    histograms.allocations.record(delta.allocations);
+    histograms.bytes.record(delta.bytes);
+    histograms.copies.record(delta.copies);
+    histograms.copied_bytes.record(delta.copied_bytes);
+}
+
+}  // namespace Allocations
+
+void* operator new(size_t size) {
+    return Allocations::allocate(size);
+}
+
+void* operator new[](size_t size) {
+    return Allocations::allocate(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return Allocations::allocate(size);
+    }
+    catch (const std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return Allocations::allocate(size);
+    }
+    catch (const std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    return Allocations::allocate_aligned(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return Allocations::allocate_aligned(size, alignment);
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, size_t, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+#endif
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "pch.h"
+#include "stats.h"
+
+#include <cstdint>
+
+/*
+Heap allocation and large copy accounting, compiled in with the
+TRACK_ALLOCATIONS CMake option. Global operator new is replaced to count
+every allocation against the stage of the innermost STAGE_SCOPE on the
+calling thread, or against no stage outside of one. Qt keeps pixel and byte
+buffers in malloc'd memory, which new never sees, so full frame copies are
+counted explicitly through COUNT_COPY.
+
+Without the option every call here is an inline no-op.
+*/
+namespace Allocations {
+
+struct Totals {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+    uint64_t copies = 0;
+    uint64_t copied_bytes = 0;
+
+    Totals operator-(const Totals& other) const {
+        return {
+            this->allocations - other.allocations,
+            this->bytes - other.bytes,
+            this->copies - other.copies,
+            this->copied_bytes - other.copied_bytes
+        };
+    }
+};
+
+#if ENABLE_ALLOCATION_TRACKING
+
+const bool enabled = true;
+
+void copied(size_t bytes);
+
+// Stage::COUNT holds whatever ran outside of any stage
+Totals totals(Stats::Stage stage);
+
+// Everything the calling thread has done, for per navigation deltas
+Totals thread_totals();
+
+/*
+Per navigation distributions, fed with the GUI thread's delta between a
+keypress and the paint that shows its image.
+*/
+struct Navigation {
+    Stats::Histogram allocations;
+    Stats::Histogram bytes;
+    Stats::Histogram copies;
+    Stats::Histogram copied_bytes;
+};
+
+Navigation& navigation();
+void navigated(const Totals& delta);
+
+#else
+
+const bool enabled = false;
+
+inline void copied(size_t) {}
+inline Totals totals(Stats::Stage) { return {}; }
+inline Totals thread_totals() { return {}; }
+inline void navigated(const Totals&) {}
+
+#endif
+
+}  // namespace Allocations
+
+#define COUNT_COPY(bytes) Allocations::copied(static_cast<size_t>(bytes))
@@ -0,0 +1,200 @@
+#include "animation.h"
+
+#include "stats.h"
+#include "trace.h"
+
+namespace Animation {
+
+namespace {
+
+// Browsers treat tiny GIF delays as 100ms, and so do many GIFs in the wild
+const int MINIMUM_DELAY = 20;
+const int DEFAULT_DELAY = 100;
+
+// How far behind we may fall before giving up on catching up
+const std::chrono::milliseconds MAXIMUM_LAG{1000};
+
+}  // namespace
+
+bool is_animated(const QString& path) {
+    QString suffix = QFileInfo(path).suffix().toLower();
+    if (suffix != "gif" && suffix != "webp" && suffix != "png") return false;
+
+    // supportsAnimation() only says the format can animate, so a still GIF
+    // would pass; a second frame is what makes it an animation. imageCount()
+    // would parse the whole file, so look past the first frame only.
+    QImageReader reader(path);
+    if (reader.read().isNull()) return false;
+    return reader.canRead();
+}
+
+Player::Player(QObject* parent) : QObject(parent) {
+    this->timer = new QTimer(this);
+    this->timer->setSingleShot(true);
+    this->timer->setTimerType(Qt::PreciseTimer);
+    connect(this->timer, &QTimer::timeout, this, &Player::present);
+    Memory::Accountant::instance().register_cache(this);
+}
+
+Player::~Player() {
+    this->stop();
+    Memory::Accountant::instance().unregister_cache(this);
+}
+
+QString Player::name() const {
+    return "animation";
+}
+
+qint64 Player::evict(qint64 bytes, Memory::Priority priority) {
+    if (priority != Memory::Priority::ADJACENT) return 0;
+
+    std::lock_guard lock(this->mutex);
+    this->capacity = MINIMUM_CAPACITY;
+
+    // The newest frames go, so playback skips over them
+    qint64 freed = 0;
+    while (freed < bytes && this->frames.size() > MINIMUM_CAPACITY) {
+        qint64 size = this->frames.back().image.sizeInBytes();
+        Memory::Accountant::instance().remove(this, Memory::Priority::ADJACENT, size);
+        this->frames.pop_back();
+        this->dropped++;
+        freed += size;
+    }
+    return freed;
+}
+
+void Player::play(const QString& path, const QSize& size) {
+    this->stop();
+
+    this->dropped = 0;
+    this->capacity = CAPACITY;
+    this->deadline = std::chrono::steady_clock::now();
+    this->worker = std::thread([this, path, size]() {
+        Trace::set_thread_name("Animation");
+        this->decode(path, size);
+    });
+    this->timer->start(0);
+}
+
+void Player::stop() {
+    this->timer->stop();
+    if (!this->worker.joinable()) return;
+
+    {
+        std::lock_guard lock(this->mutex);
+        this->stopping = true;
+    }
+    this->space.notify_all();
+    this->worker.join();
+
+    std::lock_guard lock(this->mutex);
+    while (!this->frames.empty()) this->pop_front();
+    this->stopping = false;
+    this->exhausted = false;
+
+    if (this->dropped > 0) Stats::count("animation_dropped", static_cast<uint64_t>(this->dropped));
+}
+
+bool Player::is_playing() const {
+    return this->worker.joinable();
+}
+
+void Player::decode(const QString& path, const QSize& size) {
+    while (true) {
+        QImageReader reader(path);
+        QSize original = reader.size();
+        if (original.width() > size.width() || original.height() > size.height()) {
+            reader.setScaledSize(original.scaled(size, Qt::KeepAspectRatio));
+        }
+
+        int decoded = 0;
+        while (reader.canRead()) {
+            QImage image;
+            {
+                TRACE_SCOPE("decode_frame");
+                image = reader.read();
+            }
+            if (image.isNull()) break;
+
+            int delay = reader.nextImageDelay();
+            if (delay < MINIMUM_DELAY) delay = DEFAULT_DELAY;
+            decoded++;
+
+            std::unique_lock lock(this->mutex);
+            this->space.wait(lock, [this] {
+                return this->stopping || this->frames.size() < this->capacity;
+            });
+            if (this->stopping) {
+                this->exhausted = true;
+                return;
+            }
+            this->push({std::move(image), delay});
+        }
+
+        // Loop by reopening, which works for every plugin unlike jumpToImage
+        std::lock_guard lock(this->mutex);
+        if (decoded <= 1 || this->stopping) {
+            this->exhausted = true;
+            return;
+        }
+    }
+}
+
+void Player::present() {
+    TRACE_SCOPE("present_frame");
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - this->deadline > MAXIMUM_LAG) this->deadline = now;
+
+    std::optional<Frame> current;
+    bool exhausted;
+    {
+        std::lock_guard lock(this->mutex);
+        exhausted = this->exhausted;
+        while (!this->frames.empty()) {
+            current = this->pop_front();
+
+            auto end = this->deadline + std::chrono::milliseconds(current->delay);
+            if (end > now || this->frames.empty()) break;
+
+            // This frame's slot is already over, skip to the next
+            this->deadline = end;
+            this->dropped++;
+        }
+    }
+    this->space.notify_one();
+
+    if (!current) {
+        // The decoder is behind; retry shortly without accumulating lag
+        this->deadline = now;
+        if (!exhausted) this->timer->start(5);
+        return;
+    }
+
+    emit this->frame(QPixmap::fromImage(std::move(current->image)));
+
+    this->deadline += std::chrono::milliseconds(current->delay);
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+        this->deadline - std::chrono::steady_clock::now()
+    );
+    this->timer->start(std::max(0, static_cast<int>(wait.count())));
+}
+
+void Player::push(Frame frame) {
+    // Upcoming frames, like the next images in the caches
+    Memory::Accountant::instance().add(
+        this, Memory::Priority::ADJACENT, frame.image.sizeInBytes()
+    );
+    this->frames.push_back(std::move(frame));
+}
+
+Player::Frame Player::pop_front() {
+    Frame frame = std::move(this->frames.front());
+    this->frames.pop_front();
+    Memory::Accountant::instance().remove(
+        this, Memory::Priority::ADJACENT, frame.image.sizeInBytes()
+    );
+    return frame;
+}
+
+}  // namespace Animation
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "pch.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "memory.h"
+
+namespace Animation {
+
+bool is_animated(const QString& path);
+
+/*
+Streams an animation (GIF, or animated WebP/APNG when the Qt plugin supports
+it) from disk. A worker decodes frames at display size into a small ring
+ahead of the playback clock, so only a handful of frames are resident no
+matter how long the animation is. Frames are presented against absolute
+deadlines; when the GUI thread falls behind, late frames are dropped rather
+than stretching the animation.
+
+The ring counts against the shared memory budget. Eviction shrinks it until
+the next play() and drops the frames beyond it, which shows as skipped frames.
+*/
+class Player : public QObject, public Memory::Cache {
+    Q_OBJECT
+
+   public:
+    explicit Player(QObject* parent = nullptr);
+    ~Player() override;
+
+    QString name() const override;
+    qint64 evict(qint64 bytes, Memory::Priority priority) override;
+
+    void play(const QString& path, const QSize& size);
+    void stop();
+    bool is_playing() const;
+
+   signals:
+    void frame(const QPixmap& pixmap);
+
+   private:
+    struct Frame {
+        QImage image;
+        int delay;
+    };
+
+    static constexpr size_t CAPACITY = 8;
+    // What the ring shrinks to under memory pressure
+    static constexpr size_t MINIMUM_CAPACITY = 2;
+
+    std::mutex mutex;
+    std::condition_variable space;
+    std::deque<Frame> frames;
+    size_t capacity = CAPACITY;
+    bool stopping = false;
+    // The decoder has nothing more to produce
+    bool exhausted = false;
+    std::thread worker;
+
+    QTimer* timer;
+    std::chrono::steady_clock::time_point deadline;
+    int dropped = 0;
+
+    void decode(const QString& path, const QSize& size);
+    void present();
+    // Expect mutex to be held
+    void push(Frame frame);
+    Frame pop_front();
+};
+
+}  // namespace Animation
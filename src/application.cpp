@@ -6,6 +6,44 @@ QStringList IMAGE_EXTENSIONS = {
     "heic"
 };
 
+const bool SLIM_MEMORY = [] {
+    const char* slim = std::getenv("PHOTOS_SLIM");
+    return slim && std::string(slim) != "0";
+}();
+
+const bool SIDECAR_MODE = [] {
+    const char* sidecar = std::getenv("PHOTOS_SIDECAR");
+    return sidecar && std::string(sidecar) != "0";
+}();
+
+const std::vector<const char*> PANEL_KEYS = {
+    "Exif.Image.XPTitle",
+    "Exif.Image.XPSubject",
+    "Exif.Image.ImageDescription",
+    "Exif.Image.XPComment",
+    "Exif.Image.Make",
+    "Exif.Image.Model",
+    "Exif.Image.XResolution",
+    "Exif.Image.YResolution",
+    "Exif.Image.ResolutionUnit",
+    "Exif.Image.GPSTag",
+    "Exif.Photo.DateTimeOriginal",
+    "Exif.Photo.FocalLength",
+    "Exif.Photo.FNumber",
+    "Exif.Photo.ExposureProgram",
+    "Exif.Photo.ExposureTime",
+    "Exif.Photo.ISOSpeedRatings",
+    "Exif.Photo.Flash",
+    "Exif.Photo.WhiteBalance",
+    "Exif.Photo.DigitalZoomRatio",
+    "Exif.GPSInfo.GPSLatitude",
+    "Exif.GPSInfo.GPSLatitudeRef",
+    "Exif.GPSInfo.GPSLongitude",
+    "Exif.GPSInfo.GPSLongitudeRef",
+    "Exif.GPSInfo.GPSAltitude",
+    "Exif.GPSInfo.GPSAltitudeRef"
+};
+
 QString AssetManager::operator[](const QString& key) {
     return "./assets/" + key + ".svg";
 }
@@ -35,6 +73,12 @@ inline QString qs(const std::string& string) {
 
 Application::Application(const char* folder) {
     this->resize(900, 600);
+
+    // What is known about a decoded pixmap goes when the cache drops it
+    this->decoded_cache.on_remove([this](const QString& key) {
+        this->decoded_sizes.remove(key);
+        this->decoded_spaces.remove(key);
+    });
     central_widget = new QWidget(this);
 
     this->main_layout = new QHBoxLayout(central_widget);
@@ -44,8 +88,22 @@ Application::Application(const char* folder) {
     this->image_layout = new QVBoxLayout;
     this->main_layout->addLayout(this->image_layout);
 
+    QHBoxLayout* toolbar_layout = new QHBoxLayout;
+    this->image_layout->addLayout(toolbar_layout);
+
     QPushButton* open_button = new QPushButton("Open image");
-    this->image_layout->addWidget(open_button);
+    toolbar_layout->addWidget(open_button);
+
+    this->filter_edit = new QLineEdit;
+    this->filter_edit->setPlaceholderText(
+        "Filter, e.g. camera:canon iso:100-800 date:2021..2022 near:47.6,-122.3,5"
+    );
+    this->filter_edit->setClearButtonEnabled(true);
+    toolbar_layout->addWidget(this->filter_edit, 1);
+
+    this->sort_box = new QComboBox;
+    this->sort_box->addItems({"Folder order", "Capture time"});
+    toolbar_layout->addWidget(this->sort_box);
 
     this->image_label = new QLabel;
     this->image_label->setAlignment(Qt::AlignCenter);
@@ -56,6 +114,14 @@ Application::Application(const char* folder) {
 
     this->image_layout->addWidget(image_scroll_area);
 
+    this->stats_label = new QLabel(this->image_label);
+    this->stats_label->setFont(QFont("Consolas", 9));
+    this->stats_label->setStyleSheet(
+        "QLabel { background: rgba(0, 0, 0, 160); color: white; padding: 6px; }"
+    );
+    this->stats_label->move(10, 10);
+    this->stats_label->hide();
+
     this->left_button = new QPushButton;
     this->left_button->setIcon(QIcon(icons["arrow_left"]));
     this->left_button->setFixedSize(ARROW_SIZE, ARROW_SIZE);
@@ -158,6 +224,221 @@ Application::Application(const char* folder) {
         &Application::open_directory
     );
 
+    this->player = new Animation::Player(this);
+    connect(
+        this->player,
+        &Animation::Player::frame,
+        this,
+        [this](const QPixmap& frame) {
+            this->image_label->setPixmap(frame);
+        }
+    );
+
+    this->catalog = new Library::Catalog(this);
+    connect(
+        this->catalog,
+        &Library::Catalog::progress,
+        this,
+        [this](int done, int total) {
+            this->statusBar()->showMessage(
+                QString("Indexing %1 of %2 files...").arg(done).arg(total)
+            );
+        }
+    );
+    connect(
+        this->catalog,
+        &Library::Catalog::finished,
+        this,
+        [this] {
+            this->apply_filter();
+            this->statusBar()->showMessage(
+                QString("%1 of %2 images match")
+                    .arg(this->files.size()).arg(this->library_files.size())
+            );
+            if (std::exchange(this->map_pending, false)) this->open_map();
+        }
+    );
+    connect(
+        this->filter_edit,
+        &QLineEdit::returnPressed,
+        this,
+        [this] {
+            this->query = Library::Query::parse(this->filter_edit->text());
+            if (!this->query.empty() && !this->catalog->is_ready()) {
+                this->catalog->update(this->library_files);
+                return;
+            }
+            this->apply_filter();
+        }
+    );
+
+    this->scanner = new Library::Scanner(this);
+    connect(
+        this->scanner,
+        &Library::Scanner::found,
+        this,
+        [this](const QStringList& found) {
+            this->library_files.append(found);
+            this->statusBar()->showMessage(
+                QString("Found %1 images...").arg(this->library_files.size())
+            );
+            // Filtering and sorting need the whole set, so they wait for the end
+            if (this->query.empty() && !this->sort_by_date) this->apply_filter();
+        }
+    );
+    connect(
+        this->scanner,
+        &Library::Scanner::finished,
+        this,
+        [this](const QStringList& found) {
+            bool streamed = std::exchange(this->streaming, false);
+            if (!streamed && found == this->library_files) return;
+
+            this->library_files = found;
+            if (this->catalog->is_ready() || !this->query.empty()) {
+                this->catalog->update(this->library_files);
+            }
+            if (this->sort_by_date) {
+                this->sorter->update(this->library_files);
+            }
+            if (streamed) {
+                this->statusBar()->showMessage(
+                    QString("Found %1 images").arg(this->library_files.size())
+                );
+            }
+            this->apply_filter();
+        }
+    );
+
+    this->sorter = new Exif::Sorter(this);
+    connect(
+        this->sorter,
+        &Exif::Sorter::finished,
+        this,
+        &Application::apply_filter
+    );
+    connect(
+        this->sort_box,
+        &QComboBox::currentIndexChanged,
+        this,
+        [this](int index) {
+            this->sort_by_date = index == 1;
+            if (this->sort_by_date) {
+                this->statusBar()->showMessage("Reading capture times...");
+                this->sorter->update(this->library_files);
+            }
+            this->apply_filter();
+        }
+    );
+
+    this->duplicates = new Duplicates::Engine(this);
+    connect(
+        this->duplicates,
+        &Duplicates::Engine::progress,
+        this,
+        [this](int done, int total) {
+            this->statusBar()->showMessage(
+                QString("Fingerprinting %1 of %2 files...").arg(done).arg(total)
+            );
+        }
+    );
+    connect(
+        this->duplicates,
+        &Duplicates::Engine::finished,
+        this,
+        [this] {
+            std::vector<Duplicates::Group> groups = this->duplicates->groups();
+            int exact = 0;
+            QStringList files;
+            for (const auto& group : groups) {
+                if (group.exact) exact++;
+                files.append(group.files);
+            }
+            if (groups.empty()) {
+                this->statusBar()->showMessage("No duplicates found");
+                return;
+            }
+
+            // Browse just the duplicates, like a map selection; Esc clears it
+            this->narrow(files);
+            this->statusBar()->showMessage(
+                QString("%1 duplicate groups (%2 exact), Esc shows all files")
+                    .arg(groups.size()).arg(exact)
+            );
+        }
+    );
+
+    this->baker = new Sidecar::Baker(this);
+    connect(
+        this->baker,
+        &Sidecar::Baker::progress,
+        this,
+        [this](int done, int total) {
+            this->statusBar()->showMessage(
+                QString("Baking %1 of %2 sidecars...").arg(done).arg(total)
+            );
+        }
+    );
+    connect(
+        this->baker,
+        &Sidecar::Baker::finished,
+        this,
+        [this](int baked, int failed) {
+            this->statusBar()->showMessage(
+                QString("Baked %1 sidecars into originals (%2 failed)")
+                    .arg(baked).arg(failed)
+            );
+        }
+    );
+
+    this->transforms = new Transform::Batch(this);
+    connect(
+        this->transforms,
+        &Transform::Batch::progress,
+        this,
+        [this](int done, int total) {
+            this->statusBar()->showMessage(
+                QString("Transforming %1 of %2 images...").arg(done).arg(total)
+            );
+        }
+    );
+    connect(
+        this->transforms,
+        &Transform::Batch::finished,
+        this,
+        [this](const QStringList& files, int failed) {
+            this->statusBar()->showMessage(
+                QString("Transformed %1 images (%2 failed)")
+                    .arg(files.size() - failed).arg(failed)
+            );
+            if (files.contains(this->filepath)) this->show_image(this->filepath);
+        }
+    );
+
+    this->exporter = new Export::Engine(this);
+    connect(
+        this->exporter,
+        &Export::Engine::progress,
+        this,
+        [this](int done, int total, double rate) {
+            this->statusBar()->showMessage(
+                QString("Exporting %1 of %2 images (%3 images/s)...")
+                    .arg(done).arg(total).arg(rate, 0, 'f', 1)
+            );
+        }
+    );
+    connect(
+        this->exporter,
+        &Export::Engine::finished,
+        this,
+        [this](int exported, int failed, double rate) {
+            this->statusBar()->showMessage(
+                QString("Exported %1 images at %2 images/s (%3 failed)")
+                    .arg(exported).arg(rate, 0, 'f', 1).arg(failed)
+            );
+        }
+    );
+
     QDir("cacheDir").removeRecursively();
     auto cache = new QNetworkDiskCache(this);
     cache->setCacheDirectory("cacheDir");
@@ -168,14 +449,15 @@ Application::Application(const char* folder) {
     // Ensure the cache dir is created and initialized before!
     std::cout << "Opening folder " << folder << "\n";
     if (folder) {
-        this->current_folder = QString::fromUtf8(folder ? folder : "");
-        this->reload_files();
+        this->open_folder(QString::fromUtf8(folder));
     }
 
     QTimer* refresh_timer = new QTimer;
     connect(refresh_timer, &QTimer::timeout, this, &Application::reload_files);
     refresh_timer->start(5000);
 
+    Memory::Accountant::instance().monitor_pressure();
+
     qApp->installEventFilter(this);
 
     this->is_initialized = true;
@@ -186,31 +468,150 @@ Application::Application(const char* folder) {
     });
 }
 
+Application::~Application() {
+    // Running scrub loads and histograms post back to this window, so they
+    // have to finish first
+    this->jobs.cancel();
+    this->jobs.wait();
+}
+
 bool Application::eventFilter(QObject *object, QEvent *event) {
+    // The filter is application wide; keys meant for the slideshow or the
+    // map must not navigate behind them
+    if ((event->type() == QEvent::KeyPress || event->type() == QEvent::KeyRelease) &&
+        !this->isActiveWindow()) {
+        return false;
+    }
+
     if (event->type() == QEvent::KeyPress) {
         QKeyEvent* key_event = static_cast<QKeyEvent*>(event);
+        if (key_event->key() == Qt::Key_T &&
+            key_event->modifiers() == (Qt::ControlModifier | Qt::ShiftModifier)) {
+            // First press starts recording, second press dumps the trace
+            if (!Trace::enabled) {
+                Trace::start();
+            }
+            else {
+                Trace::stop();
+                Trace::write_json(
+                    "trace-" +
+                    QDateTime::currentDateTime()
+                        .toString("yyyyMMdd-HHmmss").toStdString() +
+                    ".json"
+                );
+            }
+            return true;
+        }
+        if (key_event->key() == Qt::Key_D &&
+            key_event->modifiers() == Qt::ControlModifier) {
+            this->find_duplicates();
+            return true;
+        }
+        if (key_event->key() == Qt::Key_B &&
+            key_event->modifiers() == Qt::ControlModifier) {
+            this->bake_sidecars();
+            return true;
+        }
+        if (key_event->key() == Qt::Key_R &&
+            key_event->modifiers() == Qt::ControlModifier) {
+            this->transform({this->filepath}, Transform::Operation::ROTATE_90);
+            return true;
+        }
+        if (key_event->key() == Qt::Key_R &&
+            key_event->modifiers() == (Qt::ControlModifier | Qt::ShiftModifier)) {
+            this->transform({this->filepath}, Transform::Operation::ROTATE_270);
+            return true;
+        }
+        if (key_event->key() == Qt::Key_O &&
+            key_event->modifiers() == (Qt::ControlModifier | Qt::ShiftModifier)) {
+            // Bake EXIF orientation into every file navigation currently walks
+            this->transform(this->files, Transform::Operation::AUTO);
+            return true;
+        }
+        if (key_event->key() == Qt::Key_E &&
+            key_event->modifiers() == Qt::ControlModifier) {
+            this->export_images();
+            return true;
+        }
+        if (key_event->key() == Qt::Key_M &&
+            key_event->modifiers() == Qt::ControlModifier) {
+            this->open_map();
+            return true;
+        }
+        if (key_event->key() == Qt::Key_Escape && this->selection) {
+            this->narrow({});
+            return true;
+        }
+        if (key_event->key() == Qt::Key_F5 && !this->files.isEmpty()) {
+            auto* slideshow = new Slideshow::Window(this->files, this->image_index);
+            slideshow->showFullScreen();
+            return true;
+        }
+        if (key_event->key() == Qt::Key_F12) {
+            this->stats_label->setVisible(!this->stats_label->isVisible());
+            this->update_stats();
+            return true;
+        }
         if (key_event->key() == Qt::Key_Left) {
-            this->previous();
+            if (key_event->isAutoRepeat()) {
+                this->scrub(-1);
+            } else {
+                this->previous();
+            }
             return true;
         } else if (key_event->key() == Qt::Key_Right) {
-            this->next();
+            if (key_event->isAutoRepeat()) {
+                this->scrub(1);
+            } else {
+                this->next();
+            }
+            return true;
+        }
+    }
+    else if (event->type() == QEvent::KeyRelease && this->scrubbing) {
+        // Auto-repeat sends a release before every repeated press, so only
+        // a real release ends the scrub
+        QKeyEvent* key_event = static_cast<QKeyEvent*>(event);
+        if ((key_event->key() == Qt::Key_Left || key_event->key() == Qt::Key_Right) &&
+            !key_event->isAutoRepeat()) {
+            this->finish_scrub();
             return true;
         }
     }
+    else if (event->type() == QEvent::Paint &&
+             object == this->image_label &&
+             this->navigation_start) {
+        auto elapsed = std::chrono::steady_clock::now() - *this->navigation_start;
+        this->navigation_start.reset();
+        Stats::histogram(Stats::Stage::NAVIGATE).record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()
+        ));
+        Allocations::navigated(Allocations::thread_totals() - this->navigation_allocations);
+        // Refresh after this paint so the overlay never delays the image
+        QTimer::singleShot(0, this, &Application::update_stats);
+    }
     return QMainWindow::eventFilter(object, event);
 }
 
 void Application::resizeEvent(QResizeEvent* event) {
     QWidget::resizeEvent(event);
 
+    QSize viewport = this->oriented_viewport();
+    if (SLIM_MEMORY && !this->pixmap.isNull() && !this->filepath.isEmpty() &&
+        this->image_size.scaled(viewport, Qt::KeepAspectRatio).width() >
+            this->pixmap.width() &&
+        this->pixmap.width() < this->image_size.width()) {
+        // Growing past the decoded resolution needs a fresh decode
+        QSize size;
+        this->pixmap = Image::load_scaled(this->filepath, viewport, size);
+    }
+
     if (!this->pixmap.isNull()) {
-        QPixmap scaled_pixmap = this->pixmap.scaled(
-            this->image_scroll_area->viewport()->size(),
-            Qt::KeepAspectRatio,
-            Qt::SmoothTransformation
-        );
+        QPixmap scaled_pixmap = this->display_pixmap(viewport);
 
-        this->image_label->setPixmap(scaled_pixmap);
+        this->image_label->setPixmap(scaled_pixmap.transformed(
+            Image::orientation_transform(this->orientation)
+        ));
     }
 
     this->resize_buttons();
@@ -265,8 +666,41 @@ void Application::resize_buttons() {
     );
 }
 
+QPixmap Application::display_pixmap(const QSize& size) {
+    QImage scaled = this->pixmap.toImage().scaled(
+        size,
+        Qt::KeepAspectRatio,
+        Qt::SmoothTransformation
+    );
+    scaled.setColorSpace(this->color_space);
+    Color::to_display(scaled);
+    return QPixmap::fromImage(std::move(scaled));
+}
+
+void Application::start_navigation() {
+    this->navigation_start = std::chrono::steady_clock::now();
+    this->navigation_allocations = Allocations::thread_totals();
+}
+
+void Application::read_ahead() {
+    int count = static_cast<int>(this->files.size());
+    if (count < 2) return;
+
+    QStringList paths;
+    for (int step = 1; step <= READ_AHEAD && step < count; ++step) {
+        int index = (this->image_index + this->direction * step + count * step) % count;
+        paths.append(this->files[index]);
+    }
+    // One behind, for a step back after overshooting
+    QString behind = this->files[(this->image_index - this->direction + count) % count];
+    if (!paths.contains(behind)) paths.append(behind);
+    ReadAhead::prefetch(paths);
+}
+
 void Application::next() {
     if (this->files.isEmpty()) return;
+    this->direction = 1;
+    this->start_navigation();
     this->refresh_metadata();
     this->image_index = (this->image_index + 1) % this->files.size();
     this->filepath = files[this->image_index];
@@ -275,6 +709,8 @@ void Application::next() {
 
 void Application::previous() {
     if (this->files.isEmpty()) return;
+    this->direction = -1;
+    this->start_navigation();
     this->refresh_metadata();
     int file_size = static_cast<int>(this->files.size());
     this->image_index = (this->image_index + file_size - 1) % file_size;
@@ -284,36 +720,114 @@ void Application::previous() {
     this->show_image(this->filepath);
 }
 
-void Application::reload_files() {
-    if (this->current_folder == "") return;
+void Application::scrub(int step) {
+    if (this->files.isEmpty()) return;
+
+    if (!this->scrubbing) {
+        // Pending panel edits belong to the image the scrub started from
+        this->refresh_metadata();
+        this->metadata.clear();
+        this->player->stop();
+        this->scrubbing = true;
+    }
 
-    QStringList new_files;
-    QStringList filters = {"*.jpg", "*.jpeg", "*.heic", "*.png", "*.bmp", "*.gif"};
-    QDirIterator diriterator(
-        this->current_folder,
-        filters,
-        QDir::Files,
-        QDirIterator::Subdirectories
+    int count = static_cast<int>(this->files.size());
+    this->direction = step < 0 ? -1 : 1;
+    this->image_index = (this->image_index + count + step) % count;
+    this->filepath = this->files[this->image_index];
+    Stats::count("scrub_steps");
+
+    QString key = this->filepath + "|" + QString::number(
+        QFileInfo(this->filepath).lastModified().toMSecsSinceEpoch()
     );
+    QPixmap preview = this->preview_cache.get(key);
+    if (!preview.isNull()) {
+        this->image_label->setPixmap(preview);
+        return;
+    }
 
-    while (diriterator.hasNext()) {
-        new_files.append(diriterator.next());
+    // Loads overtaken by a later step before they start are dropped, so the
+    // pool never falls behind the key repeat
+    this->scrub_token.cancel();
+    this->scrub_token = Scheduler::Token();
+    QString path = this->filepath;
+    QSize size = this->image_scroll_area->viewport()->size();
+    this->jobs.submit(Scheduler::Priority::VISIBLE, [this, key, path, size]() {
+        QImage thumbnail = Image::load_thumbnail(path, size);
+        if (thumbnail.isNull()) return;
+        // Embedded thumbnails are tiny; a fast upscale keeps up with the repeat
+        thumbnail = thumbnail.scaled(size, Qt::KeepAspectRatio, Qt::FastTransformation);
+
+        Scheduler::post(this, [this, key, path, thumbnail]() {
+            QPixmap preview = QPixmap::fromImage(thumbnail);
+            this->preview_cache.insert(key, preview, Memory::Priority::BACKGROUND);
+            if (this->scrubbing && path == this->filepath) {
+                this->image_label->setPixmap(preview);
+            }
+        });
+    }, this->scrub_token);
+}
+
+void Application::finish_scrub() {
+    this->scrubbing = false;
+    this->scrub_token.cancel();
+
+    this->start_navigation();
+    this->show_image(this->filepath);
+}
+
+void Application::open_folder(const QString& folder) {
+    this->current_folder = folder;
+    if (this->current_folder == "") return;
+    this->library_files.clear();
+    this->selection.reset();
+
+    // Stream the walk so the first image shows before the whole tree is read
+    this->streaming = true;
+    this->scanner->scan(this->current_folder, true);
+}
+
+void Application::reload_files() {
+    // Periodic rescans run off the GUI thread and never overlap a walk
+    if (this->current_folder == "" || this->scanner->is_running()) return;
+
+    this->scanner->scan(this->current_folder, false);
+}
+
+void Application::apply_filter() {
+    QStringList new_files = this->query.empty()
+        ? this->library_files
+        : this->catalog->query(this->query);
+    if (this->selection) {
+        new_files.removeIf([this](const QString& file) {
+            return !this->selection->contains(file);
+        });
+    }
+    if (this->sort_by_date) {
+        new_files = this->sorter->sort(new_files);
     }
 
-    if (new_files != this->files) {
-        this->files = new_files;
-        if (this->files.isEmpty()) {
-            this->image_label->setText("No image files found.");
-            this->image_index = 0;
-        }
-        else {
-            this->image_index = qMin(
-                this->image_index,
-                static_cast<int>(this->files.size()) - 1
-            );
-            this->filepath = this->files[this->image_index];
-            this->show_image(this->filepath);
-        }
+    if (new_files == this->files) return;
+    this->files = new_files;
+
+    if (this->files.isEmpty()) {
+        this->image_label->setText(
+            this->query.empty() ? "No image files found." : "No images match the filter."
+        );
+        this->image_index = 0;
+        return;
+    }
+
+    // Stay on the current image if it is still part of the set
+    int index = static_cast<int>(this->files.indexOf(this->filepath));
+    this->image_index = index >= 0 ? index : qMin(
+        this->image_index,
+        static_cast<int>(this->files.size()) - 1
+    );
+
+    if (index < 0 || this->pixmap.isNull()) {
+        this->filepath = this->files[this->image_index];
+        this->show_image(this->filepath);
     }
 }
 
@@ -327,6 +841,8 @@ void Application::create_widgets(
     double latitude,
     double longitude
 ) {
+    TRACE_SCOPE("create_widgets");
+
     QWidget* container = new QWidget;
     QHBoxLayout* container_layout = new QHBoxLayout;
     container->setLayout(container_layout);
@@ -426,17 +942,7 @@ void Application::create_widgets(
                 this,
                 [this, is_binary, key](const QString& text) {
                     if (is_binary) {
-                        std::u16string utf16 = text.toStdU16String();
-                        std::ostringstream oss;
-
-                        for (char16_t ch : utf16) {
-                            oss << static_cast<int>(ch & 0xFF) << ' '
-                                << static_cast<int>((ch >> 8) & 0xFF) << ' ';
-                        }
-
-                        oss << "0 0";
-
-                        this->metadata[key] = oss.str();
+                        this->metadata[key] = Utils::to_bytes(text);
                     }
                     else {
                         this->metadata[key] = text.toStdString();
@@ -485,6 +991,10 @@ void Application::create_widgets(
         // Resize text edit to fit new content after text is updated by Qt
         QTimer::singleShot(0, this, resize);
     }
+    else if (type == DataType::HISTOGRAM) {
+        this->histogram_widget = new Histogram::Widget;
+        right_layout->addWidget(this->histogram_widget);
+    }
     else if (type == DataType::LOCATION) {
         QGVMap* map = new QGVMap(this);
         auto osm_layer = new QGVLayerOSM();
@@ -510,6 +1020,8 @@ void Application::create_widgets(
 QList<QPair<QString, QString>> Application::process_metadata(
     Exiv2::ExifData& exif_data
 ) {
+    TRACE_SCOPE("process_metadata");
+
     assert(!this->pixmap.isNull());
 
     this->edit_filepath = this->filepath;
@@ -517,14 +1029,17 @@ QList<QPair<QString, QString>> Application::process_metadata(
     QList<QPair<QString, QString>> metadata;
     std::map<std::string, std::string> exifdata;
 
-    for (auto it = exif_data.begin(); it != exif_data.end(); ++it) {
-        exifdata[it->key()] = it->value().toString();
-        // std::cout << it->key() << ": " << it->value().toString() << "\n";
+    // Only stringify what the panel shows; maker notes alone can be huge
+    for (const char* panel_key : PANEL_KEYS) {
+        auto it = exif_data.findKey(Exiv2::ExifKey(panel_key));
+        if (it != exif_data.end()) {
+            exifdata[panel_key] = it->value().toString();
+        }
     }
 
-    for (const auto& pair : exif_data) {
-        std::string key = pair.key();
-        QString value = qs(pair.toString());
+    // Edits waiting in a sidecar win over what is embedded in the file
+    for (auto& [sidecar_key, value] : Sidecar::read(this->filepath)) {
+        exifdata[sidecar_key] = value;
     }
 
     // if (exifdata.contains("Exif.Image.XPTitle")) {
@@ -585,23 +1100,36 @@ QList<QPair<QString, QString>> Application::process_metadata(
         );
     }
 
-    QImage image = pixmap.toImage();
-
-    double x_resolution = image.dotsPerMeterX() / INCH_TO_METER;
-    double y_resolution = image.dotsPerMeterY() / INCH_TO_METER;
+    // Read DPI from metadata instead of converting the pixmap to a QImage
+    double x_resolution = 72.0;
+    double y_resolution = 72.0;
+    if (exifdata.contains("Exif.Image.XResolution") &&
+        exifdata.contains("Exif.Image.YResolution")) {
+        x_resolution = Utils::parse_rational(exifdata["Exif.Image.XResolution"]);
+        y_resolution = Utils::parse_rational(exifdata["Exif.Image.YResolution"]);
+        // Pixels per centimetre; INCH_TO_METER / 100 is inches per centimetre
+        if (exifdata["Exif.Image.ResolutionUnit"] == "3") {
+            x_resolution /= INCH_TO_METER / 100.0;
+            y_resolution /= INCH_TO_METER / 100.0;
+        }
+    }
 
     QFileInfo fileinfo(this->filepath);
 
     int dpi = static_cast<int>(std::sqrt(x_resolution * y_resolution));
 
+    QSize oriented_size = Image::swaps_axes(this->orientation)
+        ? this->image_size.transposed()
+        : this->image_size;
+
     this->create_widgets(
         "Size info",
         {
             {
                 "Dimensions",
-                QString::number(image.width()) +
+                QString::number(oriented_size.width()) +
                 " x " +
-                QString::number(image.height())
+                QString::number(oriented_size.height())
             },
             { "File size", Utils::format_size(fileinfo.size()) },
             { "DPI", QString::number(dpi) + " dpi" }
@@ -609,6 +1137,13 @@ QList<QPair<QString, QString>> Application::process_metadata(
         icons["dimension"]
     );
 
+    this->create_widgets(
+        "Histogram",
+        {},
+        icons["histogram"],
+        DataType::HISTOGRAM
+    );
+
     if (exifdata.contains("Exif.Photo.ExposureTime")) {
         QString focal_length;
         {
@@ -782,18 +1317,74 @@ QList<QPair<QString, QString>> Application::process_metadata(
 }
 
 void Application::open_directory() {
-    this->current_folder = QFileDialog::getExistingDirectory(
+    this->open_folder(QFileDialog::getExistingDirectory(
         this,
         "Open folder",
         "",
         QFileDialog::ShowDirsOnly | QFileDialog::DontResolveSymlinks
-    );
-    this->reload_files();
+    ));
 }
 
 void Application::show_image(const QString& filepath) {
+    TRACE_SCOPE("show_image");
+
     this->metadata.clear();
-    this->pixmap = Image::load_image(filepath);
+    this->player->stop();
+
+    // Include the modification time so edits made elsewhere are picked up
+    QString key = filepath + "|" + QString::number(
+        QFileInfo(filepath).lastModified().toMSecsSinceEpoch()
+    );
+
+    // Orientation comes from the same pass that feeds the panel, and decides
+    // the size to decode at
+    {
+        TRACE_SCOPE("read_metadata");
+        STAGE_SCOPE(Stats::Stage::EXIF);
+        Exif::recover(filepath);
+        this->image = Exiv2::ImageFactory::open(filepath.toStdString());
+
+        this->image->readMetadata();
+    }
+    this->orientation = Image::read_orientation(filepath, this->image->exifData());
+    QTransform transform = Image::orientation_transform(this->orientation);
+
+    // Sideways images are decoded and scaled to fit the transposed viewport,
+    // then turned at display resolution
+    QSize max_size = this->oriented_viewport();
+
+    // In slim mode only display resolution pixels are ever decoded
+    if (SLIM_MEMORY) {
+        key += "|" + QString::number(max_size.width()) +
+            "x" + QString::number(max_size.height());
+    }
+
+    this->pixmap = this->decoded_cache.get(key);
+    if (!this->pixmap.isNull()) {
+        this->image_size = this->decoded_sizes.value(key, this->pixmap.size());
+        this->color_space = this->decoded_spaces.value(key);
+    }
+    else {
+        if (SLIM_MEMORY) {
+            this->pixmap = Image::load_scaled(filepath, max_size, this->image_size);
+            // Converted while still an image
+            this->color_space = QColorSpace();
+        }
+        else {
+            this->pixmap = Image::load_image(filepath, this->color_space);
+            this->image_size = this->pixmap.size();
+        }
+        if (!this->pixmap.isNull()) {
+            this->decoded_cache.insert(key, this->pixmap, Memory::Priority::VISIBLE);
+            if (SLIM_MEMORY) {
+                this->decoded_sizes[key] = this->image_size;
+            }
+            else {
+                this->decoded_spaces[key] = this->color_space;
+            }
+        }
+    }
+    this->read_ahead();
     if (this->pixmap.isNull()) {
         std::cerr << "Failed to load image: " << filepath.toStdString()
                     << std::endl;
@@ -808,28 +1399,43 @@ void Application::show_image(const QString& filepath) {
     this->field_layout = new QVBoxLayout(this->field_layoutw);
     this->field_layoutw->setLayout(this->field_layout);
 
-    QSize max_size(
-        this->image_scroll_area->viewport()->width(),
-        this->image_scroll_area->viewport()->height()
-    );
-
-    QPixmap scaled_pixmap = pixmap.scaled(
-        max_size,
-        Qt::KeepAspectRatio,
-        Qt::SmoothTransformation
-    );
-    this->image_label->setPixmap(scaled_pixmap);
-
-    this->image = Exiv2::ImageFactory::open(filepath.toStdString());
+    QPixmap display;
+    if (SLIM_MEMORY) {
+        display = this->pixmap.transformed(transform);
+        this->image_label->setPixmap(display);
+    }
+    else {
+        TRACE_SCOPE("scale_pixmap");
+        STAGE_SCOPE(Stats::Stage::SCALE);
+        QString scaled_key = key + "|" + QString::number(max_size.width()) +
+            "x" + QString::number(max_size.height());
+
+        QPixmap scaled_pixmap = this->scaled_cache.get(scaled_key);
+        if (scaled_pixmap.isNull()) {
+            scaled_pixmap = this->display_pixmap(max_size).transformed(transform);
+            this->scaled_cache.insert(
+                scaled_key, scaled_pixmap, Memory::Priority::VISIBLE
+            );
+        }
+        display = scaled_pixmap;
+        this->image_label->setPixmap(scaled_pixmap);
+    }
+    this->retag_caches();
 
-    this->image->readMetadata();
-    this->exif_data = this->image->exifData();
+    if (Animation::is_animated(filepath)) {
+        this->player->play(filepath, this->image_scroll_area->viewport()->size());
+    }
 
-    // if (this->exif_data.empty()) {
+    // if (this->image->exifData().empty()) {
         // return;// this->image_label->setText("")
     // } else {
-    process_metadata(this->exif_data);
+    {
+        STAGE_SCOPE(Stats::Stage::PANEL);
+        process_metadata(this->image->exifData());
+    }
     // }
+
+    this->update_histogram(key, display);
 }
 
 void Application::refresh_metadata() {
@@ -837,11 +1443,15 @@ void Application::refresh_metadata() {
 
     qDebug() << "Writing metadata to " << this->edit_filepath << "\n";
 
-    for (auto& [key, value] : this->metadata) {
-        // std::cout << key << " was changed to "
-        //           << value << " from " << this->exif_data[key];
-        this->exif_data[key] = value;
-        // std::cout << key << ": " << value << "\n";
+    // Most RAW containers cannot be rewritten safely, so edits stay beside them
+    if (SIDECAR_MODE || Image::is_raw(this->edit_filepath)) {
+        // The panel encodes XP edits as byte strings for everything but HEIC
+        Sidecar::write(
+            this->edit_filepath,
+            this->metadata,
+            !this->edit_filepath.endsWith(".heic")
+        );
+        return;
     }
 
     this->image = Image::write_image(
@@ -852,3 +1462,145 @@ void Application::refresh_metadata() {
 
     // this->metadata.clear();
 }
+
+void Application::update_stats() {
+    if (!this->stats_label->isVisible()) return;
+
+    this->stats_label->setText(Stats::summary() + "\n" + Memory::summary());
+    this->stats_label->adjustSize();
+    this->stats_label->raise();
+}
+
+void Application::find_duplicates() {
+    if (this->files.isEmpty()) return;
+
+    this->statusBar()->showMessage("Searching for duplicates...");
+    this->duplicates->scan(this->files);
+}
+
+QSize Application::oriented_viewport() const {
+    QSize viewport = this->image_scroll_area->viewport()->size();
+    return Image::swaps_axes(this->orientation) ? viewport.transposed() : viewport;
+}
+
+void Application::update_histogram(const QString& key, const QPixmap& display) {
+    this->histogram_key = key;
+
+    auto cached = this->histograms.constFind(key);
+    if (cached != this->histograms.constEnd()) {
+        if (this->histogram_widget) this->histogram_widget->set_bins(*cached);
+        return;
+    }
+
+    // Raster pixmaps share their QImage, so this does not copy pixels
+    QImage image = display.toImage();
+    this->jobs.submit(Scheduler::Priority::VISIBLE, [this, key, image]() {
+        Histogram::Bins bins = Histogram::compute(image);
+        Scheduler::post(this, [this, key, bins]() {
+            // A few KB each, so a coarse bound is plenty
+            if (this->histograms.size() > 1024) this->histograms.clear();
+            this->histograms.insert(key, bins);
+            if (key == this->histogram_key && this->histogram_widget) {
+                this->histogram_widget->set_bins(bins);
+            }
+        });
+    });
+}
+
+void Application::transform(
+    const QStringList& files,
+    Transform::Operation operation
+) {
+    if (files.isEmpty() || files.first().isEmpty() ||
+        this->transforms->is_running()) {
+        return;
+    }
+
+    // Pending panel edits would otherwise be written over the new file
+    this->refresh_metadata();
+    this->metadata.clear();
+
+    this->statusBar()->showMessage("Transforming images...");
+    this->transforms->start(files, operation);
+}
+
+void Application::export_images() {
+    if (this->files.isEmpty() || this->exporter->is_running()) return;
+
+    QString directory = QFileDialog::getExistingDirectory(
+        this, "Export to", this->current_folder
+    );
+    if (directory.isEmpty()) return;
+
+    // Exports read the files on disk, so flush pending panel edits first
+    this->refresh_metadata();
+
+    Export::Options options;
+    options.directory = directory;
+    this->statusBar()->showMessage("Exporting images...");
+    this->exporter->start(this->files, options);
+}
+
+void Application::open_map() {
+    if (this->library_files.isEmpty()) return;
+
+    // Locations come from the catalog, which is only read on demand
+    if (!this->catalog->is_ready()) {
+        this->map_pending = true;
+        this->statusBar()->showMessage("Reading locations...");
+        this->catalog->update(this->library_files);
+        return;
+    }
+
+    auto* map = new Atlas::Window(this->catalog->records());
+    connect(map, &Atlas::Window::narrowed, this, &Application::narrow);
+    map->show();
+}
+
+void Application::narrow(const QStringList& files) {
+    if (files.isEmpty()) {
+        this->selection.reset();
+    } else {
+        this->selection = QSet<QString>(files.begin(), files.end());
+    }
+    this->apply_filter();
+
+    if (this->selection) {
+        this->statusBar()->showMessage(
+            QString("Showing %1 photos from the map, Esc shows all").arg(this->files.size())
+        );
+        this->activateWindow();
+    } else {
+        this->statusBar()->clearMessage();
+    }
+}
+
+void Application::bake_sidecars() {
+    if (this->baker->is_running()) return;
+
+    // Filters may hide images that still have pending sidecars
+    this->statusBar()->showMessage("Baking sidecars into originals...");
+    this->baker->bake(this->library_files);
+}
+
+void Application::retag_caches() {
+    int count = static_cast<int>(this->files.size());
+    auto priority = [this, count](const QString& key) {
+        // Keys end in |mtime, and scaled ones in |mtime|WxH after that; the
+        // path itself may contain '|', so strip from the end
+        QString path = key;
+        if (path.section('|', -1).contains('x')) path = path.section('|', 0, -2);
+        path = path.section('|', 0, -2);
+        if (path == this->filepath) return Memory::Priority::VISIBLE;
+        if (count > 0 &&
+            (path == this->files[(this->image_index + 1) % count] ||
+             path == this->files[(this->image_index + count - 1) % count])) {
+            return Memory::Priority::ADJACENT;
+        }
+        return Memory::Priority::BACKGROUND;
+    };
+
+    this->decoded_cache.retag(priority);
+    this->scaled_cache.retag(priority);
+    this->preview_cache.retag(priority);
+}
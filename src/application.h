@@ -2,11 +2,32 @@
 
 #include "pch.h"
 
+#include "allocations.h"
+#include "animation.h"
+#include "atlas.h"
+#include "color.h"
+#include "duplicates.h"
+#include "exif_reader.h"
+#include "exif_writer.h"
+#include "export.h"
+#include "histogram.h"
+#include "jpeg_transform.h"
+#include "library.h"
 #include "loader.h"
+#include "memory.h"
+#include "readahead.h"
+#include "scheduler.h"
+#include "sidecar.h"
+#include "slideshow.h"
+#include "stats.h"
+#include "trace.h"
 #include "utils.h"
+#include "watchdog.h"
 
 const int DATAPANEL_WIDTH = 340;
 const int ARROW_SIZE = 40;
+// Images whose bytes are fetched ahead of the navigation
+const int READ_AHEAD = 3;
 const double INCH_TO_METER = 39.3701;
 
 struct FieldData {
@@ -15,7 +36,17 @@ struct FieldData {
 
 extern QStringList IMAGE_EXTENSIONS;
 
-enum class DataType { STRING, DATE, MULTISTRING, MULTILINE, LOCATION };
+// Keep only display resolution pixels resident, set through PHOTOS_SLIM
+extern const bool SLIM_MEMORY;
+
+// Save edits to .xmp sidecars instead of the originals, set through
+// PHOTOS_SIDECAR
+extern const bool SIDECAR_MODE;
+
+// Every EXIF key the metadata panel reads
+extern const std::vector<const char*> PANEL_KEYS;
+
+enum class DataType { STRING, DATE, MULTISTRING, MULTILINE, LOCATION, HISTOGRAM };
 
 struct MetadataField {
     QString name;
@@ -45,6 +76,7 @@ inline QString qs(const std::string& string);
 class Application : public QMainWindow {
    public:
     Application(const char* folder = nullptr);
+    ~Application() override;
 
    protected:
     bool eventFilter(QObject* object, QEvent* event) override;
@@ -64,6 +96,7 @@ class Application : public QMainWindow {
     QVBoxLayout* field_layout;
     QWidget* field_layoutw;
     QLabel* image_label;
+    QLabel* stats_label;
     QScrollArea* image_scroll_area;
 
     QPushButton* left_button;
@@ -74,19 +107,83 @@ class Application : public QMainWindow {
     QString filepath;
     QString edit_filepath;
     QPixmap pixmap;
+    // Full resolution dimensions, which pixmap may not have in slim mode
+    QSize image_size;
+    // EXIF orientation of the current image, applied after downscaling
+    int orientation = 1;
+    // Per decoded_cache entry, and removed with it
+    QHash<QString, QSize> decoded_sizes;
+    // Color space of pixmap's pixels, invalid when they need no conversion.
+    // Only display sized copies are converted.
+    QColorSpace color_space;
+    QHash<QString, QColorSpace> decoded_spaces;
+    Animation::Player* player;
+    Memory::PixmapCache decoded_cache{"decoded"};
+    Memory::PixmapCache scaled_cache{"scaled"};
+    // Thumbnails shown while a navigation key is held
+    Memory::PixmapCache preview_cache{"preview"};
+    // Per image key, computed from the displayed pixmap off the GUI thread
+    QHash<QString, Histogram::Bins> histograms;
+    QString histogram_key;
+    QPointer<Histogram::Widget> histogram_widget;
     std::unique_ptr<Exiv2::Image> image;
-    Exiv2::ExifData exif_data;
 
     std::map<std::string, std::string> metadata;
 
     // QFileSystemWatcher* watcher;
+    // Everything found in the folder, and the subset navigation walks
+    QStringList library_files;
     QStringList files;
     QString current_folder;
+    Library::Scanner* scanner;
+    // Set while a newly opened folder streams in
+    bool streaming = false;
     int image_index = 0;
-
+    // Last navigation step, 1 or -1, which the read-ahead follows
+    int direction = 1;
+
+    // Set while a navigation key auto-repeats; only the image the key is
+    // released on gets a full decode and panel
+    bool scrubbing = false;
+    // Cancelled per scrub step so queued thumbnail loads are dropped
+    Scheduler::Token scrub_token;
+    // Pool work that posts back to this window
+    Scheduler::Group jobs;
+
+    // Set on navigation and cleared once the new image is painted
+    std::optional<std::chrono::steady_clock::time_point> navigation_start;
+    // GUI thread allocation totals at navigation_start
+    Allocations::Totals navigation_allocations;
+
+    Duplicates::Engine* duplicates;
+    Sidecar::Baker* baker;
+    Transform::Batch* transforms;
+    Export::Engine* exporter;
+
+    QLineEdit* filter_edit;
+    Library::Catalog* catalog;
+    Library::Query query;
+    // Photos picked on the library map, cleared with Esc
+    std::optional<QSet<QString>> selection;
+    bool map_pending = false;
+
+    QComboBox* sort_box;
+    Exif::Sorter* sorter;
+    bool sort_by_date = false;
+
+    // pixmap fitted within size and converted for the display, unoriented
+    QPixmap display_pixmap(const QSize& size);
+    // Queue the raw bytes of the next images in the navigation direction
+    void read_ahead();
+    // Start the keypress to paint measurement for the image about to show
+    void start_navigation();
     void next();
     void previous();
+    void scrub(int step);
+    void finish_scrub();
+    void open_folder(const QString& folder);
     void reload_files();
+    void apply_filter();
 
     void create_widgets(
         const QString& title,
@@ -106,5 +203,15 @@ class Application : public QMainWindow {
     void open_directory();
     void show_image(const QString& filepath);
     void refresh_metadata();
+    void update_stats();
+    void retag_caches();
+    void find_duplicates();
+    void bake_sidecars();
+    void transform(const QStringList& files, Transform::Operation operation);
+    void export_images();
+    void open_map();
+    void narrow(const QStringList& files);
+    void update_histogram(const QString& key, const QPixmap& display);
+    QSize oriented_viewport() const;
 };
 
@@ -0,0 +1,272 @@
+#include "atlas.h"
+
+#include <numbers>
+
+#include "stats.h"
+#include "trace.h"
+
+namespace Atlas {
+
+namespace {
+
+// Web Mercator stops short of the poles
+const double MAX_LATITUDE = 85.05112878;
+
+// Target width of a grid cell on screen, which bounds how close two
+// clusters can be drawn
+const double CELL_PIXELS = 64.0;
+
+uint64_t spread(uint32_t value) {
+    uint64_t bits = value;
+    bits = (bits | (bits << 16)) & 0x0000FFFF0000FFFFull;
+    bits = (bits | (bits << 8)) & 0x00FF00FF00FF00FFull;
+    bits = (bits | (bits << 4)) & 0x0F0F0F0F0F0F0F0Full;
+    bits = (bits | (bits << 2)) & 0x3333333333333333ull;
+    bits = (bits | (bits << 1)) & 0x5555555555555555ull;
+    return bits;
+}
+
+uint64_t morton(double x, double y) {
+    const double cells = static_cast<double>(1u << Clusters::LEVELS);
+    auto cell = [cells](double value) {
+        return static_cast<uint32_t>(std::clamp(value * cells, 0.0, cells - 1));
+    };
+    return spread(cell(x)) | (spread(cell(y)) << 1);
+}
+
+}  // namespace
+
+Clusters::Clusters(const std::vector<Library::Record>& records) {
+    TRACE_SCOPE("cluster_points");
+
+    for (const Library::Record& record : records) {
+        if (!record.has_location()) continue;
+
+        QPointF position = project(record.latitude, record.longitude);
+        this->points.push_back({
+            morton(position.x(), position.y()),
+            position.x(),
+            position.y(),
+            record.path
+        });
+    }
+    std::sort(
+        this->points.begin(),
+        this->points.end(),
+        [](const Point& a, const Point& b) { return a.code < b.code; }
+    );
+}
+
+const std::vector<Clusters::Cluster>& Clusters::level(int level) {
+    level = std::clamp(level, 0, LEVELS);
+    if (this->levels[level]) return *this->levels[level];
+
+    TRACE_SCOPE("cluster_level");
+
+    std::vector<Cluster> clusters;
+    auto add = [&clusters](uint64_t cell, uint32_t begin, uint32_t end, double x, double y) {
+        if (!clusters.empty() && clusters.back().cell == cell) {
+            Cluster& last = clusters.back();
+            double weight = static_cast<double>(last.size());
+            double added = static_cast<double>(end - begin);
+            last.x = (last.x * weight + x * added) / (weight + added);
+            last.y = (last.y * weight + y * added) / (weight + added);
+            last.end = end;
+        }
+        else {
+            clusters.push_back({cell, begin, end, x, y});
+        }
+    };
+
+    // Merging a finer level touches one entry per cluster rather than one
+    // per photo
+    int finer = level + 1;
+    while (finer <= LEVELS && !this->levels[finer]) ++finer;
+
+    if (finer <= LEVELS) {
+        const int shift = 2 * (finer - level);
+        for (const Cluster& cluster : *this->levels[finer]) {
+            add(cluster.cell >> shift, cluster.begin, cluster.end, cluster.x, cluster.y);
+        }
+    }
+    else {
+        const int shift = 2 * (LEVELS - level);
+        for (size_t i = 0; i < this->points.size(); ++i) {
+            const Point& point = this->points[i];
+            add(
+                point.code >> shift,
+                static_cast<uint32_t>(i),
+                static_cast<uint32_t>(i + 1),
+                point.x,
+                point.y
+            );
+        }
+    }
+
+    Stats::count("map_clusters_built", clusters.size());
+    this->levels[level] = std::move(clusters);
+    return *this->levels[level];
+}
+
+QStringList Clusters::files(const Cluster& cluster) const {
+    QStringList files;
+    files.reserve(cluster.size());
+    for (uint32_t i = cluster.begin; i < cluster.end; ++i) {
+        files.append(this->points[i].path);
+    }
+    return files;
+}
+
+size_t Clusters::size() const {
+    return this->points.size();
+}
+
+QPointF Clusters::project(double latitude, double longitude) {
+    double radians = std::clamp(latitude, -MAX_LATITUDE, MAX_LATITUDE) * std::numbers::pi / 180;
+    return QPointF(
+        (longitude + 180.0) / 360.0,
+        (1.0 - std::log(std::tan(radians) + 1.0 / std::cos(radians)) / std::numbers::pi) / 2.0
+    );
+}
+
+QGV::GeoPos Clusters::unproject(double x, double y) {
+    double latitude = std::atan(std::sinh(std::numbers::pi * (1.0 - 2.0 * y)));
+    return QGV::GeoPos(latitude * 180 / std::numbers::pi, x * 360.0 - 180.0);
+}
+
+Layer::Layer(std::shared_ptr<Clusters> clusters) : clusters(std::move(clusters)) {
+    this->setFlags(QGV::ItemFlag::Clickable);
+}
+
+QPainterPath Layer::projShape() const {
+    // Clicks anywhere reach the layer, which then looks for a cluster
+    QPainterPath path;
+    path.addRect(this->getMap()->getProjection()->boundaryProjRect());
+    return path;
+}
+
+void Layer::projPaint(QPainter* painter) {
+    TRACE_SCOPE("paint_clusters");
+
+    const QGVCameraState camera = this->getMap()->getCamera();
+    const double scale = camera.scale();
+    // Clusters just outside the view still show their edge
+    const double margin = this->radius(std::numeric_limits<uint32_t>::max()) / scale;
+    const QRectF visible = camera.projRect().adjusted(-margin, -margin, margin, margin);
+    QGVProjection* projection = this->getMap()->getProjection();
+
+    QFont font = painter->font();
+    font.setPixelSize(11);
+    font.setBold(true);
+    painter->setFont(font);
+    painter->setRenderHint(QPainter::Antialiasing);
+
+    for (const Clusters::Cluster& cluster : this->clusters->level(this->current)) {
+        QPointF center = projection->geoToProj(Clusters::unproject(cluster.x, cluster.y));
+        if (!visible.contains(center)) continue;
+
+        // Draw in screen pixels so markers keep their size at every zoom
+        painter->save();
+        painter->translate(center);
+        painter->scale(1 / scale, 1 / scale);
+
+        double radius = this->radius(cluster.size());
+        painter->setPen(QPen(QColor(255, 255, 255, 230), 2));
+        painter->setBrush(QColor(30, 110, 220, 200));
+        painter->drawEllipse(QPointF(0, 0), radius, radius);
+        if (cluster.size() > 1) {
+            painter->setPen(Qt::white);
+            painter->drawText(
+                QRectF(-radius, -radius, 2 * radius, 2 * radius),
+                Qt::AlignCenter,
+                QString::number(cluster.size())
+            );
+        }
+        painter->restore();
+    }
+}
+
+void Layer::projOnMouseClick(const QPointF& projPos) {
+    const double scale = this->getMap()->getCamera().scale();
+    QGVProjection* projection = this->getMap()->getProjection();
+
+    const Clusters::Cluster* hit = nullptr;
+    double best = std::numeric_limits<double>::max();
+    for (const Clusters::Cluster& cluster : this->clusters->level(this->current)) {
+        QPointF center = projection->geoToProj(Clusters::unproject(cluster.x, cluster.y));
+        double distance = QLineF(center, projPos).length() * scale;
+        if (distance <= this->radius(cluster.size()) && distance < best) {
+            best = distance;
+            hit = &cluster;
+        }
+    }
+    if (hit) emit this->selected(this->clusters->files(*hit));
+}
+
+void Layer::onCamera(const QGVCameraState& oldState, const QGVCameraState& newState) {
+    QGVDrawItem::onCamera(oldState, newState);
+
+    // Panning keeps the level, so only zooming regroups the points
+    int level = this->level_for(newState.scale());
+    if (level == this->current) return;
+
+    this->current = level;
+    this->repaint();
+}
+
+int Layer::level_for(double scale) const {
+    double world = this->getMap()->getProjection()->boundaryProjRect().width() * scale;
+    int level = static_cast<int>(std::floor(std::log2(std::max(world / CELL_PIXELS, 1.0))));
+    return std::clamp(level, 0, Clusters::LEVELS);
+}
+
+double Layer::radius(uint32_t size) const {
+    // Grows with the digits of the count and stays within a grid cell
+    return std::min(8.0 + 4.0 * std::log10(static_cast<double>(size)), CELL_PIXELS / 2 - 4);
+}
+
+Window::Window(const std::vector<Library::Record>& records) {
+    this->setAttribute(Qt::WA_DeleteOnClose);
+    this->setWindowTitle("Library map");
+    this->resize(1000, 700);
+
+    auto clusters = std::make_shared<Clusters>(records);
+
+    this->map = new QGVMap(this);
+    this->map->addItem(new QGVLayerOSM());
+    auto layer = new Layer(clusters);
+    this->map->addItem(layer);
+    connect(layer, &Layer::selected, this, &Window::narrowed);
+
+    QLabel* summary = new QLabel(
+        QString("%1 geotagged photos. Click a cluster to browse it.")
+            .arg(clusters->size())
+    );
+    QVBoxLayout* layout = new QVBoxLayout(this);
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->addWidget(this->map, 1);
+    layout->addWidget(summary);
+
+    // Frame every photo. This builds the finest level, which every coarser
+    // level is then merged from
+    double min_x = 1, min_y = 1, max_x = 0, max_y = 0;
+    for (const Clusters::Cluster& cluster : clusters->level(Clusters::LEVELS)) {
+        min_x = std::min(min_x, cluster.x);
+        min_y = std::min(min_y, cluster.y);
+        max_x = std::max(max_x, cluster.x);
+        max_y = std::max(max_y, cluster.y);
+    }
+    if (clusters->size() > 0) {
+        // A single location would otherwise zoom in without limit
+        const double padding = 1e-4;
+        QTimer::singleShot(0, this, [this, min_x, min_y, max_x, max_y, padding] {
+            QGV::GeoPos top_left = Clusters::unproject(min_x - padding, min_y - padding);
+            QGV::GeoPos bottom_right = Clusters::unproject(max_x + padding, max_y + padding);
+            this->map->cameraTo(QGVCameraActions(this->map).scaleTo(
+                QGV::GeoRect(top_left, bottom_right)
+            ));
+        });
+    }
+}
+
+}  // namespace Atlas
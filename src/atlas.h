@@ -0,0 +1,98 @@
+#pragma once
+
+#include "pch.h"
+
+#include "library.h"
+
+namespace Atlas {
+
+/*
+Grid clustering over geotagged photos. Points are kept in Morton (Z-order)
+over their Web Mercator position, so every grid cell at every level is a
+contiguous run of points: a cluster is just a range, and a coarser level is
+built by merging neighbouring runs of the next finer level that is already
+known. Levels are built on first use and cached.
+*/
+class Clusters {
+   public:
+    // Level n splits the world into 2^n by 2^n cells
+    static constexpr int LEVELS = 24;
+
+    struct Cluster {
+        uint64_t cell;
+        uint32_t begin;
+        uint32_t end;
+        // Mean of the members' positions, normalized to [0, 1)
+        double x;
+        double y;
+
+        uint32_t size() const { return this->end - this->begin; }
+    };
+
+    explicit Clusters(const std::vector<Library::Record>& records);
+
+    const std::vector<Cluster>& level(int level);
+    QStringList files(const Cluster& cluster) const;
+    size_t size() const;
+
+    static QPointF project(double latitude, double longitude);
+    static QGV::GeoPos unproject(double x, double y);
+
+   private:
+    struct Point {
+        uint64_t code;
+        double x;
+        double y;
+        QString path;
+    };
+
+    std::vector<Point> points;
+    std::array<std::optional<std::vector<Cluster>>, LEVELS + 1> levels;
+};
+
+/*
+Draws every cluster of the level that matches the zoom as a single item, so
+the scene holds one object however many photos there are. Clicking a cluster
+emits its files.
+*/
+class Layer : public QGVDrawItem {
+    Q_OBJECT
+
+   public:
+    explicit Layer(std::shared_ptr<Clusters> clusters);
+
+   signals:
+    void selected(const QStringList& files);
+
+   protected:
+    QPainterPath projShape() const override;
+    void projPaint(QPainter* painter) override;
+    void projOnMouseClick(const QPointF& projPos) override;
+    void onCamera(const QGVCameraState& oldState, const QGVCameraState& newState) override;
+
+   private:
+    std::shared_ptr<Clusters> clusters;
+    int current = 0;
+
+    int level_for(double scale) const;
+    double radius(uint32_t size) const;
+};
+
+/*
+Library wide map of every geotagged record. Picking a cluster narrows
+navigation in the main window to its photos.
+*/
+class Window : public QWidget {
+    Q_OBJECT
+
+   public:
+    explicit Window(const std::vector<Library::Record>& records);
+
+   signals:
+    void narrowed(const QStringList& files);
+
+   private:
+    QGVMap* map;
+};
+
+}  // namespace Atlas
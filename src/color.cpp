@@ -0,0 +1,100 @@
+#include "color.h"
+
+#include <mutex>
+
+#include "allocations.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "trace.h"
+
+namespace Color {
+
+namespace {
+
+struct Entry {
+    QColorSpace source;
+    QColorSpace display;
+    QColorTransform transform;
+};
+
+// A library mixes a handful of profiles at most, so a linear scan is enough
+std::mutex transforms_mutex;
+std::vector<Entry> transforms;
+
+// Rows per task; enough work to outweigh scheduling a task
+const int BAND_ROWS = 64;
+
+QColorSpace load_display() {
+    const char* path = std::getenv("PHOTOS_DISPLAY_ICC");
+    if (!path || !*path) return QColorSpace(QColorSpace::SRgb);
+
+    QFile file(path);
+    QColorSpace space;
+    if (file.open(QIODevice::ReadOnly)) {
+        space = QColorSpace::fromIccProfile(file.readAll());
+    }
+    if (!space.isValid()) {
+        std::cerr << "Ignoring unusable display profile " << path << "\n";
+        return QColorSpace(QColorSpace::SRgb);
+    }
+    return space;
+}
+
+}  // namespace
+
+const QColorSpace& display() {
+    static const QColorSpace space = load_display();
+    return space;
+}
+
+QColorTransform transform(const QColorSpace& source) {
+    const QColorSpace& target = display();
+
+    std::lock_guard lock(transforms_mutex);
+    for (const Entry& entry : transforms) {
+        if (entry.source == source && entry.display == target) return entry.transform;
+    }
+
+    Stats::count("color_transforms");
+    transforms.push_back({source, target, source.transformationToColorSpace(target)});
+    return transforms.back().transform;
+}
+
+void to_display(QImage& image) {
+    TRACE_SCOPE("color_to_display");
+
+    QColorSpace source = image.colorSpace();
+    if (image.isNull() || !source.isValid() || source == display()) return;
+
+    STAGE_SCOPE(Stats::Stage::COLOR);
+    QColorTransform conversion = transform(source);
+
+    // applyColorTransform works on 32-bit pixels; decoders mostly hand those
+    // out already, HEIC comes as RGB888
+    if (image.depth() != 32) {
+        image = image.convertToFormat(
+            image.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32
+        );
+        COUNT_COPY(image.sizeInBytes());
+    }
+
+    // Detach once here; the bands below write into the shared buffer
+    uchar* bits = image.bits();
+    qsizetype stride = image.bytesPerLine();
+    int width = image.width();
+    int height = image.height();
+    QImage::Format format = image.format();
+
+    int bands = (height + BAND_ROWS - 1) / BAND_ROWS;
+    Scheduler::parallel_for(bands, Scheduler::Priority::VISIBLE, [&](int band) {
+        int top = band * BAND_ROWS;
+        int rows = std::min(BAND_ROWS, height - top);
+        // Wraps the rows without copying them
+        QImage view(bits + top * stride, width, rows, stride, format);
+        view.applyColorTransform(conversion);
+    });
+
+    image.setColorSpace(display());
+}
+
+}  // namespace Color
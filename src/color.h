@@ -0,0 +1,28 @@
+#pragma once
+
+#include "pch.h"
+
+namespace Color {
+
+/*
+The profile images are converted to for display: the ICC file named by
+PHOTOS_DISPLAY_ICC, or sRGB when unset or unreadable.
+*/
+const QColorSpace& display();
+
+/*
+The transform from source to the display profile. Built once per
+(source, display) pair and shared afterwards, since building one parses
+curves and allocates lookup tables. Safe to call from worker threads.
+*/
+QColorTransform transform(const QColorSpace& source);
+
+/*
+Convert image from its tagged color space to the display's, in place, with
+rows split across the shared scheduler. Only call it on display sized
+images. Untagged images and images already in the display space are left
+alone. Safe to call from worker threads.
+*/
+void to_display(QImage& image);
+
+}  // namespace Color
@@ -0,0 +1,322 @@
+#include "duplicates.h"
+
+#include "loader.h"
+#include "scheduler.h"
+#include "trace.h"
+
+namespace Duplicates {
+
+uint64_t dhash(const QImage& image) {
+    QImage small = image
+        .convertToFormat(QImage::Format_Grayscale8)
+        .scaled(9, 8, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+
+    uint64_t hash = 0;
+    for (int y = 0; y < 8; ++y) {
+        const uchar* row = small.constScanLine(y);
+        for (int x = 0; x < 8; ++x) {
+            hash = (hash << 1) | (row[x] < row[x + 1] ? 1 : 0);
+        }
+    }
+    return hash;
+}
+
+std::optional<uint64_t> content_hash(const QString& path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return std::nullopt;
+
+    const uint64_t prime_1 = 0x87c37b91114253d5ull;
+    const uint64_t prime_2 = 0x4cf5ad432745937full;
+
+    uint64_t hash = 0x9e3779b97f4a7c15ull ^ static_cast<uint64_t>(file.size());
+    std::vector<char> buffer(1 << 20);
+
+    while (true) {
+        qint64 read = file.read(buffer.data(), static_cast<qint64>(buffer.size()));
+        if (read < 0) return std::nullopt;
+        if (read == 0) break;
+
+        size_t length = static_cast<size_t>(read);
+        size_t offset = 0;
+        for (; offset + 8 <= length; offset += 8) {
+            uint64_t word;
+            std::memcpy(&word, buffer.data() + offset, sizeof(word));
+            hash ^= std::rotl(word * prime_1, 31) * prime_2;
+            hash = std::rotl(hash, 27) * 5 + 0x52dce729;
+        }
+        for (; offset < length; ++offset) {
+            hash ^= static_cast<uint8_t>(buffer[offset]) * prime_1;
+            hash = std::rotl(hash, 11) * prime_2;
+        }
+    }
+
+    hash ^= hash >> 33;
+    hash *= prime_2;
+    hash ^= hash >> 29;
+    return hash;
+}
+
+uint16_t Index::chunk(uint64_t hash, int index) {
+    return static_cast<uint16_t>(hash >> (index * CHUNK_BITS));
+}
+
+void Index::build(std::vector<uint64_t> hashes) {
+    this->hashes = std::move(hashes);
+
+    for (int c = 0; c < CHUNKS; ++c) {
+        auto& offsets = this->offsets[static_cast<size_t>(c)];
+        auto& ids = this->ids[static_cast<size_t>(c)];
+
+        offsets.assign(KEYS + 1, 0);
+        for (uint64_t hash : this->hashes) {
+            offsets[chunk(hash, c) + 1u]++;
+        }
+        for (size_t key = 0; key < KEYS; ++key) {
+            offsets[key + 1] += offsets[key];
+        }
+
+        std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+        ids.resize(this->hashes.size());
+        for (size_t i = 0; i < this->hashes.size(); ++i) {
+            ids[cursor[chunk(this->hashes[i], c)]++] = static_cast<uint32_t>(i);
+        }
+    }
+}
+
+void Index::search(
+    uint64_t hash,
+    int radius,
+    std::vector<uint32_t>& results
+) const {
+    size_t first = results.size();
+
+    for (int c = 0; c < CHUNKS; ++c) {
+        const auto& offsets = this->offsets[static_cast<size_t>(c)];
+        const auto& ids = this->ids[static_cast<size_t>(c)];
+
+        auto visit = [&](uint16_t key) {
+            for (uint32_t i = offsets[key]; i < offsets[key + 1u]; ++i) {
+                uint32_t id = ids[i];
+                if (distance(this->hashes[id], hash) <= radius) {
+                    results.push_back(id);
+                }
+            }
+        };
+
+        // Every key within radius / CHUNKS bit flips of this chunk
+        auto enumerate = [&](auto& self, uint16_t key, int bit, int flips) -> void {
+            visit(key);
+            if (flips == 0) return;
+            for (int b = bit; b < CHUNK_BITS; ++b) {
+                self(self, static_cast<uint16_t>(key ^ (1u << b)), b + 1, flips - 1);
+            }
+        };
+        enumerate(enumerate, chunk(hash, c), 0, radius / CHUNKS);
+    }
+
+    // A hash close in several chunks is found once per chunk
+    std::sort(results.begin() + static_cast<std::ptrdiff_t>(first), results.end());
+    results.erase(
+        std::unique(results.begin() + static_cast<std::ptrdiff_t>(first), results.end()),
+        results.end()
+    );
+}
+
+Engine::Engine(QObject* parent) : QObject(parent) {}
+
+Engine::~Engine() {
+    this->cancel();
+}
+
+void Engine::scan(const QStringList& files, int threshold) {
+    this->cancel();
+    this->cancelled = false;
+
+    this->worker = QThread::create([this, files, threshold]() {
+        Trace::set_thread_name("Duplicates");
+        this->run(files, threshold);
+    });
+    this->worker->start(QThread::LowPriority);
+}
+
+void Engine::cancel() {
+    if (!this->worker) return;
+
+    this->cancelled = true;
+    this->worker->wait();
+    delete this->worker;
+    this->worker = nullptr;
+}
+
+bool Engine::is_running() const {
+    return this->worker && this->worker->isRunning();
+}
+
+std::vector<Group> Engine::groups() const {
+    std::lock_guard lock(this->mutex);
+    return this->results;
+}
+
+void Engine::run(const QStringList& files, int threshold) {
+    TRACE_SCOPE("duplicates_scan");
+
+    const int total = static_cast<int>(files.size());
+    std::vector<Fingerprint> prints(static_cast<size_t>(total));
+
+    for (int i = 0; i < total; ++i) {
+        QFileInfo info(files[i]);
+        prints[static_cast<size_t>(i)].size = info.size();
+        prints[static_cast<size_t>(i)].modified =
+            info.lastModified().toMSecsSinceEpoch();
+    }
+    {
+        std::lock_guard lock(this->mutex);
+        for (int i = 0; i < total; ++i) {
+            Fingerprint& fingerprint = prints[static_cast<size_t>(i)];
+            auto it = this->cache.find(files[i]);
+            if (it != this->cache.end() &&
+                it->second.size == fingerprint.size &&
+                it->second.modified == fingerprint.modified) {
+                fingerprint = it->second;
+            }
+        }
+    }
+
+    // Only files sharing a size can be byte-identical, so only those are read
+    std::vector<bool> needs_content(static_cast<size_t>(total), false);
+    {
+        std::map<qint64, int> sizes;
+        for (int i = 0; i < total; ++i) {
+            auto [it, inserted] = sizes.try_emplace(prints[static_cast<size_t>(i)].size, i);
+            if (!inserted) {
+                needs_content[static_cast<size_t>(i)] = true;
+                needs_content[static_cast<size_t>(it->second)] = true;
+            }
+        }
+    }
+
+    {
+        TRACE_SCOPE("duplicates_fingerprint");
+
+        const int chunk = 64;
+        std::atomic<int> done{0};
+
+        Scheduler::parallel_for(
+            (total + chunk - 1) / chunk,
+            Scheduler::Priority::THUMBNAIL,
+            [&](int index) {
+                int begin = index * chunk;
+                int end = std::min(begin + chunk, total);
+                for (int i = begin; i < end && !this->cancelled; ++i) {
+                    Fingerprint& fingerprint = prints[static_cast<size_t>(i)];
+                    if (!fingerprint.has_perceptual) {
+                        QImage preview = Image::load_preview(files[i], {64, 64});
+                        if (!preview.isNull()) {
+                            fingerprint.perceptual = dhash(preview);
+                            fingerprint.has_perceptual = true;
+                        }
+                    }
+                    if (needs_content[static_cast<size_t>(i)] && !fingerprint.has_content) {
+                        // Unreadable files stay without one, so they never
+                        // match each other
+                        if (std::optional<uint64_t> hash = content_hash(files[i])) {
+                            fingerprint.content = *hash;
+                            fingerprint.has_content = true;
+                        }
+                    }
+                }
+                emit this->progress(done += end - begin, total);
+            }
+        );
+    }
+
+    {
+        std::lock_guard lock(this->mutex);
+        for (int i = 0; i < total; ++i) {
+            this->cache[files[i]] = prints[static_cast<size_t>(i)];
+        }
+    }
+    if (this->cancelled) return;
+
+    TRACE_SCOPE("duplicates_group");
+
+    std::vector<int> parents(static_cast<size_t>(total));
+    std::iota(parents.begin(), parents.end(), 0);
+
+    auto find = [&](int i) {
+        while (parents[static_cast<size_t>(i)] != i) {
+            parents[static_cast<size_t>(i)] =
+                parents[static_cast<size_t>(parents[static_cast<size_t>(i)])];
+            i = parents[static_cast<size_t>(i)];
+        }
+        return i;
+    };
+    auto unite = [&](int a, int b) {
+        parents[static_cast<size_t>(find(a))] = find(b);
+    };
+
+    std::map<std::pair<qint64, uint64_t>, int> contents;
+    std::vector<uint64_t> hashes;
+    std::vector<int> hashed;
+
+    for (int i = 0; i < total; ++i) {
+        const Fingerprint& fingerprint = prints[static_cast<size_t>(i)];
+        if (fingerprint.has_content) {
+            auto [it, inserted] = contents.try_emplace(
+                {fingerprint.size, fingerprint.content}, i
+            );
+            if (!inserted) unite(i, it->second);
+        }
+        if (fingerprint.has_perceptual) {
+            hashes.push_back(fingerprint.perceptual);
+            hashed.push_back(i);
+        }
+    }
+
+    Index index;
+    index.build(hashes);
+
+    std::vector<uint32_t> matches;
+    for (size_t k = 0; k < hashed.size(); ++k) {
+        matches.clear();
+        index.search(hashes[k], threshold, matches);
+        for (uint32_t match : matches) {
+            if (match > k) unite(hashed[k], hashed[match]);
+        }
+    }
+
+    std::map<int, std::vector<int>> members;
+    for (int i = 0; i < total; ++i) {
+        members[find(i)].push_back(i);
+    }
+
+    std::vector<Group> groups;
+    for (const auto& [root, indices] : members) {
+        if (indices.size() < 2) continue;
+
+        const Fingerprint& first = prints[static_cast<size_t>(indices[0])];
+        Group group;
+        group.exact = true;
+        for (int i : indices) {
+            const Fingerprint& fingerprint = prints[static_cast<size_t>(i)];
+            group.exact = group.exact &&
+                fingerprint.has_content &&
+                fingerprint.size == first.size &&
+                fingerprint.content == first.content;
+            group.files.append(files[i]);
+        }
+        groups.push_back(std::move(group));
+    }
+
+    std::sort(groups.begin(), groups.end(), [](const Group& a, const Group& b) {
+        return a.files.size() > b.files.size();
+    });
+
+    {
+        std::lock_guard lock(this->mutex);
+        this->results = std::move(groups);
+    }
+    emit this->finished();
+}
+
+}  // namespace Duplicates
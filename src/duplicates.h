@@ -0,0 +1,101 @@
+#pragma once
+
+#include "pch.h"
+
+#include <array>
+#include <atomic>
+#include <mutex>
+
+namespace Duplicates {
+
+struct Fingerprint {
+    qint64 size = 0;
+    qint64 modified = 0;
+    uint64_t content = 0;
+    uint64_t perceptual = 0;
+    bool has_content = false;
+    bool has_perceptual = false;
+};
+
+struct Group {
+    QStringList files;
+    // Every file in the group is byte-identical
+    bool exact = false;
+};
+
+inline int distance(uint64_t a, uint64_t b) {
+    return std::popcount(a ^ b);
+}
+
+/*
+64-bit difference hash: each bit records whether a pixel of a 9x8 grayscale
+thumbnail is brighter than its right neighbour.
+*/
+uint64_t dhash(const QImage& image);
+
+/*
+Hash of the file's bytes, or nothing when it cannot be read.
+*/
+std::optional<uint64_t> content_hash(const QString& path);
+
+/*
+Multi-index hash over 64-bit perceptual hashes. The hash is split into four
+16-bit chunks; by the pigeonhole principle any hash within radius r of the
+query matches at least one chunk within r / 4 bits, so only those buckets are
+scanned and verified.
+*/
+class Index {
+    static constexpr int CHUNKS = 4;
+    static constexpr int CHUNK_BITS = 16;
+    static constexpr size_t KEYS = size_t{1} << CHUNK_BITS;
+
+    std::vector<uint64_t> hashes;
+    std::array<std::vector<uint32_t>, CHUNKS> offsets;
+    std::array<std::vector<uint32_t>, CHUNKS> ids;
+
+    static uint16_t chunk(uint64_t hash, int index);
+
+   public:
+    void build(std::vector<uint64_t> hashes);
+
+    void search(
+        uint64_t hash,
+        int radius,
+        std::vector<uint32_t>& results
+    ) const;
+};
+
+/*
+Fingerprints a file set on a background thread and groups exact and
+near-identical images. Fingerprints are cached per path, size and
+modification time, so rescans only touch new or changed files.
+*/
+class Engine : public QObject {
+    Q_OBJECT
+
+   public:
+    explicit Engine(QObject* parent = nullptr);
+    ~Engine() override;
+
+    void scan(const QStringList& files, int threshold = 8);
+    void cancel();
+    bool is_running() const;
+
+    std::vector<Group> groups() const;
+
+   signals:
+    void progress(int done, int total);
+    void finished();
+
+   private:
+    mutable std::mutex mutex;
+    std::map<QString, Fingerprint> cache;
+    std::vector<Group> results;
+
+    QThread* worker = nullptr;
+    std::atomic<bool> cancelled{false};
+
+    void run(const QStringList& files, int threshold);
+};
+
+}  // namespace Duplicates
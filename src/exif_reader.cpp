@@ -0,0 +1,463 @@
+#include "exif_reader.h"
+
+#include "trace.h"
+
+namespace Exif {
+
+namespace {
+
+constexpr qint64 HEADER_SIZE = 16 * 1024;
+
+/*
+Sliding window over a file. Pointers returned by at() are invalidated by the
+next call.
+*/
+class Window {
+    QFile& file;
+    QByteArray buffer;
+    qint64 base = 0;
+
+   public:
+    explicit Window(QFile& file) : file(file) {}
+
+    const uint8_t* at(qint64 offset, qint64 length) {
+        if (offset < 0 || length < 0) return nullptr;
+
+        if (offset < this->base ||
+            offset + length > this->base + this->buffer.size()) {
+            if (!this->file.seek(offset)) return nullptr;
+            this->buffer = this->file.read(std::max(length, HEADER_SIZE));
+            this->base = offset;
+            if (this->buffer.size() < length) return nullptr;
+        }
+        return reinterpret_cast<const uint8_t*>(this->buffer.constData()) +
+               (offset - this->base);
+    }
+};
+
+uint64_t read_be(const uint8_t* data, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) value = (value << 8) | data[i];
+    return value;
+}
+
+qint64 parse_time_string(const uint8_t* data, size_t length) {
+    QString text = QString::fromLatin1(
+        reinterpret_cast<const char*>(data),
+        static_cast<qsizetype>(strnlen(reinterpret_cast<const char*>(data), length))
+    );
+    QDateTime time = QDateTime::fromString(text.trimmed(), "yyyy:MM:dd HH:mm:ss");
+    return time.isValid() ? time.toMSecsSinceEpoch() : NO_TIME;
+}
+
+std::optional<qint64> read_jpeg(Window& window) {
+    qint64 position = 2;
+
+    while (true) {
+        const uint8_t* marker = window.at(position, 4);
+        if (!marker || marker[0] != 0xFF) return std::nullopt;
+
+        // Start of scan or end of image: there is no Exif block
+        if (marker[1] == 0xDA || marker[1] == 0xD9) return NO_TIME;
+        if (marker[1] == 0xFF) {
+            position++;
+            continue;
+        }
+
+        auto length = static_cast<qint64>(read_be(marker + 2, 2));
+        if (length < 2) return std::nullopt;
+
+        if (marker[1] == 0xE1 && length >= 8) {
+            const uint8_t* segment = window.at(position + 4, length - 2);
+            if (!segment) return std::nullopt;
+            if (std::memcmp(segment, "Exif\0\0", 6) == 0) {
+                return parse_tiff_time(segment + 6, static_cast<size_t>(length - 8));
+            }
+        }
+        position += 2 + length;
+    }
+}
+
+struct Box {
+    qint64 offset;
+    qint64 content;
+    qint64 end;
+    uint32_t type;
+};
+
+std::optional<Box> read_box(Window& window, qint64 offset, qint64 end) {
+    const uint8_t* header = window.at(offset, 8);
+    if (!header) return std::nullopt;
+
+    auto size = static_cast<qint64>(read_be(header, 4));
+    auto type = static_cast<uint32_t>(read_be(header + 4, 4));
+    qint64 content = offset + 8;
+
+    if (size == 1) {
+        const uint8_t* large = window.at(offset + 8, 8);
+        if (!large) return std::nullopt;
+        size = static_cast<qint64>(read_be(large, 8));
+        content += 8;
+    }
+    else if (size == 0) {
+        size = end - offset;
+    }
+
+    if (size < content - offset || offset + size > end) return std::nullopt;
+    return Box{offset, content, offset + size, type};
+}
+
+constexpr uint32_t fourcc(const char (&code)[5]) {
+    return static_cast<uint32_t>(code[0]) << 24 | static_cast<uint32_t>(code[1]) << 16 |
+           static_cast<uint32_t>(code[2]) << 8 | static_cast<uint32_t>(code[3]);
+}
+
+std::optional<uint32_t> find_exif_item(Window& window, const Box& iinf) {
+    const uint8_t* header = window.at(iinf.content, 8);
+    if (!header) return std::nullopt;
+
+    int version = header[0];
+    qint64 position = iinf.content + 4 + (version == 0 ? 2 : 4);
+
+    while (position < iinf.end) {
+        auto infe = read_box(window, position, iinf.end);
+        if (!infe) return std::nullopt;
+        position = infe->end;
+        if (infe->type != fourcc("infe")) continue;
+
+        const uint8_t* entry = window.at(infe->content, 14);
+        if (!entry || entry[0] < 2) continue;
+
+        int id_size = entry[0] == 2 ? 2 : 4;
+        auto id = static_cast<uint32_t>(read_be(entry + 4, id_size));
+        auto type = static_cast<uint32_t>(read_be(entry + 4 + id_size + 2, 4));
+        if (type == fourcc("Exif")) return id;
+    }
+    return std::nullopt;
+}
+
+std::optional<std::pair<qint64, qint64>> find_item_extent(
+    Window& window,
+    const Box& iloc,
+    uint32_t item
+) {
+    const uint8_t* header = window.at(iloc.content, 8);
+    if (!header) return std::nullopt;
+
+    int version = header[0];
+    int offset_size = header[4] >> 4;
+    int length_size = header[4] & 0xF;
+    int base_offset_size = header[5] >> 4;
+    int index_size = version >= 1 ? header[5] & 0xF : 0;
+
+    qint64 position = iloc.content + 6;
+    const uint8_t* count_data = window.at(position, version < 2 ? 2 : 4);
+    if (!count_data) return std::nullopt;
+    uint64_t count = read_be(count_data, version < 2 ? 2 : 4);
+    position += version < 2 ? 2 : 4;
+
+    for (uint64_t i = 0; i < count; ++i) {
+        const uint8_t* entry = window.at(position, 64);
+        if (!entry) entry = window.at(position, iloc.end - position);
+        if (!entry) return std::nullopt;
+
+        int cursor = 0;
+        int id_size = version < 2 ? 2 : 4;
+        auto id = static_cast<uint32_t>(read_be(entry, id_size));
+        cursor += id_size;
+
+        int construction_method = 0;
+        if (version >= 1) {
+            construction_method = static_cast<int>(read_be(entry + cursor, 2) & 0xF);
+            cursor += 2;
+        }
+        cursor += 2;  // data_reference_index
+
+        auto base = static_cast<qint64>(read_be(entry + cursor, base_offset_size));
+        cursor += base_offset_size;
+
+        auto extents = static_cast<int>(read_be(entry + cursor, 2));
+        cursor += 2;
+
+        int extent_size = index_size + offset_size + length_size;
+        const uint8_t* extent = window.at(position + cursor, extents * extent_size);
+        if (!extent) return std::nullopt;
+
+        if (id == item) {
+            // Only items stored directly in the file, in a single extent
+            if (construction_method != 0 || extents != 1) return std::nullopt;
+            auto offset = static_cast<qint64>(read_be(extent + index_size, offset_size));
+            auto length = static_cast<qint64>(
+                read_be(extent + index_size + offset_size, length_size)
+            );
+            return std::make_pair(base + offset, length);
+        }
+
+        position += cursor + extents * extent_size;
+    }
+    return std::nullopt;
+}
+
+std::optional<qint64> read_heif(Window& window, qint64 file_size) {
+    qint64 position = 0;
+    std::optional<Box> meta;
+
+    while (position < file_size && !meta) {
+        auto box = read_box(window, position, file_size);
+        if (!box) return std::nullopt;
+        if (box->type == fourcc("meta")) meta = box;
+        position = box->end;
+    }
+    if (!meta) return std::nullopt;
+
+    std::optional<Box> iinf;
+    std::optional<Box> iloc;
+
+    // meta is a full box, skip its version and flags
+    position = meta->content + 4;
+    while (position < meta->end) {
+        auto box = read_box(window, position, meta->end);
+        if (!box) return std::nullopt;
+        if (box->type == fourcc("iinf")) iinf = box;
+        if (box->type == fourcc("iloc")) iloc = box;
+        position = box->end;
+    }
+    if (!iinf || !iloc) return std::nullopt;
+
+    auto item = find_exif_item(window, *iinf);
+    if (!item) return NO_TIME;
+
+    auto extent = find_item_extent(window, *iloc, *item);
+    if (!extent || extent->second < 8) return std::nullopt;
+
+    const uint8_t* data = window.at(extent->first, extent->second);
+    if (!data) return std::nullopt;
+
+    // The Exif item starts with the offset of the TIFF header
+    auto tiff_offset = static_cast<qint64>(read_be(data, 4));
+    if (4 + tiff_offset >= extent->second) return std::nullopt;
+
+    return parse_tiff_time(
+        data + 4 + tiff_offset,
+        static_cast<size_t>(extent->second - 4 - tiff_offset)
+    );
+}
+
+qint64 read_exiv2(const QString& path) {
+    try {
+        auto image = Exiv2::ImageFactory::open(path.toStdString());
+        image->readMetadata();
+        Exiv2::ExifData& exif_data = image->exifData();
+        for (const char* key : {"Exif.Photo.DateTimeOriginal", "Exif.Image.DateTime"}) {
+            auto it = exif_data.findKey(Exiv2::ExifKey(key));
+            if (it == exif_data.end()) continue;
+
+            std::string value = it->value().toString();
+            return parse_time_string(
+                reinterpret_cast<const uint8_t*>(value.data()),
+                value.size()
+            );
+        }
+    }
+    catch (const std::exception& error) {
+        std::cerr << "Failed to read capture time of " << path.toStdString()
+                  << ": " << error.what() << "\n";
+    }
+    return NO_TIME;
+}
+
+}  // namespace
+
+qint64 parse_tiff_time(const uint8_t* data, size_t size) {
+    if (size < 8) return NO_TIME;
+
+    bool little;
+    if (data[0] == 'I' && data[1] == 'I') little = true;
+    else if (data[0] == 'M' && data[1] == 'M') little = false;
+    else return NO_TIME;
+
+    auto read = [&](size_t offset, int bytes, uint32_t& value) {
+        if (offset + static_cast<size_t>(bytes) > size) return false;
+        value = 0;
+        for (int i = 0; i < bytes; ++i) {
+            size_t index = offset + static_cast<size_t>(little ? bytes - 1 - i : i);
+            value = (value << 8) | data[index];
+        }
+        return true;
+    };
+
+    struct Entry {
+        uint32_t type;
+        uint32_t count;
+        size_t value;
+    };
+
+    auto find = [&](uint32_t ifd, uint32_t tag) -> std::optional<Entry> {
+        uint32_t entries;
+        if (!read(ifd, 2, entries)) return std::nullopt;
+
+        for (uint32_t i = 0; i < entries; ++i) {
+            size_t entry = ifd + 2 + size_t{i} * 12;
+            uint32_t entry_tag, type, count;
+            if (!read(entry, 2, entry_tag)) return std::nullopt;
+            if (entry_tag != tag) continue;
+            if (!read(entry + 2, 2, type) || !read(entry + 4, 4, count)) return std::nullopt;
+            return Entry{type, count, entry + 8};
+        }
+        return std::nullopt;
+    };
+
+    auto ascii_time = [&](uint32_t ifd, uint32_t tag) -> qint64 {
+        auto entry = find(ifd, tag);
+        if (!entry || entry->type != 2) return NO_TIME;
+
+        // Strings longer than four bytes are stored out of line
+        uint32_t offset = static_cast<uint32_t>(entry->value);
+        if (entry->count > 4 && !read(entry->value, 4, offset)) return NO_TIME;
+        if (size_t{offset} + entry->count > size) return NO_TIME;
+        return parse_time_string(data + offset, entry->count);
+    };
+
+    uint32_t ifd0;
+    if (!read(4, 4, ifd0)) return NO_TIME;
+
+    uint32_t exif_ifd;
+    auto pointer = find(ifd0, 0x8769);
+    if (pointer && read(pointer->value, 4, exif_ifd)) {
+        qint64 time = ascii_time(exif_ifd, 0x9003);
+        if (time != NO_TIME) return time;
+    }
+    return ascii_time(ifd0, 0x0132);
+}
+
+qint64 read_capture_time(const QString& path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return NO_TIME;
+
+    Window window(file);
+    const uint8_t* header = window.at(0, 12);
+
+    std::optional<qint64> time;
+    if (header && header[0] == 0xFF && header[1] == 0xD8) {
+        time = read_jpeg(window);
+    }
+    else if (header && std::memcmp(header + 4, "ftyp", 4) == 0) {
+        time = read_heif(window, file.size());
+    }
+
+    return time ? *time : read_exiv2(path);
+}
+
+Sorter::Sorter(QObject* parent) : QObject(parent) {}
+
+Sorter::~Sorter() {
+    this->cancel();
+}
+
+void Sorter::update(const QStringList& files) {
+    this->cancel();
+    this->cancelled = false;
+
+    Exiv2::XmpParser::initialize();
+
+    this->worker = QThread::create([this, files]() {
+        Trace::set_thread_name("Sorter");
+        this->run(files);
+    });
+    this->worker->start(QThread::LowPriority);
+}
+
+void Sorter::cancel() {
+    if (!this->worker) return;
+
+    this->cancelled = true;
+    this->worker->wait();
+    delete this->worker;
+    this->worker = nullptr;
+}
+
+qint64 Sorter::lookup(const QString& path) const {
+    std::lock_guard lock(this->mutex);
+    auto it = this->entries.constFind(path);
+    return it == this->entries.constEnd() ? NO_TIME : it->time;
+}
+
+QStringList Sorter::sort(const QStringList& files) const {
+    TRACE_SCOPE("sort_by_capture_time");
+
+    std::vector<std::pair<qint64, int>> keys;
+    keys.reserve(static_cast<size_t>(files.size()));
+    {
+        std::lock_guard lock(this->mutex);
+        for (int i = 0; i < files.size(); ++i) {
+            auto it = this->entries.constFind(files[i]);
+            qint64 time = it == this->entries.constEnd() ? NO_TIME : it->time;
+            keys.emplace_back(time == NO_TIME ? std::numeric_limits<qint64>::max() : time, i);
+        }
+    }
+
+    std::stable_sort(keys.begin(), keys.end(), [](const auto& a, const auto& b) {
+        return a.first < b.first;
+    });
+
+    QStringList sorted;
+    sorted.reserve(files.size());
+    for (const auto& [time, index] : keys) sorted.append(files[index]);
+    return sorted;
+}
+
+void Sorter::run(const QStringList& files) {
+    TRACE_SCOPE("capture_times");
+
+    const int total = static_cast<int>(files.size());
+    std::vector<Entry> results(static_cast<size_t>(total));
+    std::vector<bool> stale(static_cast<size_t>(total), true);
+
+    for (int i = 0; i < total; ++i) {
+        QFileInfo info(files[i]);
+        results[static_cast<size_t>(i)].size = info.size();
+        results[static_cast<size_t>(i)].modified = info.lastModified().toMSecsSinceEpoch();
+    }
+    {
+        std::lock_guard lock(this->mutex);
+        for (int i = 0; i < total; ++i) {
+            Entry& entry = results[static_cast<size_t>(i)];
+            auto it = this->entries.constFind(files[i]);
+            if (it != this->entries.constEnd() &&
+                it->size == entry.size && it->modified == entry.modified) {
+                entry.time = it->time;
+                stale[static_cast<size_t>(i)] = false;
+            }
+        }
+    }
+
+    {
+        const int chunk = 256;
+        QThreadPool pool;
+        // Mostly waiting on I/O, so oversubscribe for network filesystems
+        pool.setMaxThreadCount(std::max(8, QThread::idealThreadCount() * 2));
+
+        for (int begin = 0; begin < total; begin += chunk) {
+            pool.start([&, begin]() {
+                int end = std::min(begin + chunk, total);
+                for (int i = begin; i < end && !this->cancelled; ++i) {
+                    if (stale[static_cast<size_t>(i)]) {
+                        results[static_cast<size_t>(i)].time = read_capture_time(files[i]);
+                    }
+                }
+            });
+        }
+        pool.waitForDone();
+    }
+    if (this->cancelled) return;
+
+    {
+        std::lock_guard lock(this->mutex);
+        for (int i = 0; i < total; ++i) {
+            this->entries[files[i]] = results[static_cast<size_t>(i)];
+        }
+    }
+    emit this->finished();
+}
+
+}  // namespace Exif
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "pch.h"
+
+#include <atomic>
+#include <limits>
+#include <mutex>
+
+namespace Exif {
+
+// A capture time that is absent; anything else is valid, including times
+// before 1970
+const qint64 NO_TIME = std::numeric_limits<qint64>::min();
+
+/*
+Read DateTimeOriginal straight from the JPEG APP1 segment or the HEIF Exif
+item, touching only the first few KB of the file plus the Exif block itself.
+Falls back to a full Exiv2 open for anything else. Returns milliseconds since
+the epoch, or NO_TIME when the file has no capture time.
+*/
+qint64 read_capture_time(const QString& path);
+
+/*
+Parse a TIFF structure (the payload of an Exif block) for DateTimeOriginal,
+falling back to IFD0 DateTime, or NO_TIME when it has neither.
+*/
+qint64 parse_tiff_time(const uint8_t* data, size_t size);
+
+/*
+Capture times for a file set, read in parallel on a background thread and
+cached per path, size and modification time.
+*/
+class Sorter : public QObject {
+    Q_OBJECT
+
+   public:
+    explicit Sorter(QObject* parent = nullptr);
+    ~Sorter() override;
+
+    void update(const QStringList& files);
+    void cancel();
+
+    qint64 lookup(const QString& path) const;
+
+    /*
+    Order files by capture time. Files without one keep their relative order
+    and go last.
+    */
+    QStringList sort(const QStringList& files) const;
+
+   signals:
+    void finished();
+
+   private:
+    struct Entry {
+        qint64 size = 0;
+        qint64 modified = 0;
+        qint64 time = NO_TIME;
+    };
+
+    mutable std::mutex mutex;
+    QHash<QString, Entry> entries;
+
+    QThread* worker = nullptr;
+    std::atomic<bool> cancelled{false};
+
+    void run(const QStringList& files);
+};
+
+}  // namespace Exif
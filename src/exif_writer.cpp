@@ -0,0 +1,308 @@
+#include "exif_writer.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "stats.h"
+#include "trace.h"
+
+namespace Exif {
+
+namespace {
+
+const char JOURNAL_MAGIC[8] = {'P', 'H', 'O', 'T', 'O', 'S', 'J', '1'};
+
+// Marker, length and "Exif\0\0" in front of the TIFF block
+const qint64 HEADER_SIZE = 10;
+
+// The length field is 16 bits and counts itself but not the marker
+const qint64 MAXIMUM_SEGMENT = 0xFFFF + 2;
+
+const qint64 COPY_CHUNK = 1024 * 1024;
+
+struct Layout {
+    // Start of the Exif APP1 marker and its whole size, or -1 when absent
+    qint64 exif_offset = -1;
+    qint64 exif_size = 0;
+    // Where a new APP1 goes: after SOI and a leading JFIF APP0
+    qint64 insert_at = 2;
+    Exiv2::ByteOrder byte_order = Exiv2::littleEndian;
+};
+
+std::optional<Layout> scan(QFile& file) {
+    uchar soi[2];
+    if (file.read(reinterpret_cast<char*>(soi), 2) != 2 ||
+        soi[0] != 0xFF || soi[1] != 0xD8) {
+        return std::nullopt;
+    }
+
+    Layout layout;
+    qint64 position = 2;
+    while (true) {
+        uchar header[4];
+        if (!file.seek(position) ||
+            file.read(reinterpret_cast<char*>(header), 4) != 4 ||
+            header[0] != 0xFF) {
+            return std::nullopt;
+        }
+
+        uchar marker = header[1];
+        if (marker == 0xFF) {
+            // Fill byte before the actual marker
+            position++;
+            continue;
+        }
+        if (marker == 0xDA || marker == 0xD9) break;
+
+        qint64 length = header[2] << 8 | header[3];
+        if (length < 2) return std::nullopt;
+
+        if (marker == 0xE0 && layout.insert_at == position) {
+            layout.insert_at = position + 2 + length;
+        }
+        if (marker == 0xE1 && layout.exif_offset < 0 && length >= 16) {
+            char ident[8];
+            if (file.read(ident, 8) == 8 && std::memcmp(ident, "Exif\0\0", 6) == 0) {
+                layout.exif_offset = position;
+                layout.exif_size = 2 + length;
+                layout.byte_order = ident[6] == 'M'
+                    ? Exiv2::bigEndian
+                    : Exiv2::littleEndian;
+            }
+        }
+        position += 2 + length;
+    }
+    return layout;
+}
+
+/*
+A complete APP1 segment of exactly size bytes, zero padded after the TIFF
+block. Exif readers follow IFD offsets and never look at the padding.
+*/
+QByteArray build_segment(const Exiv2::Blob& blob, qint64 size) {
+    QByteArray segment(size, '\0');
+    qint64 length = size - 2;
+    segment[0] = static_cast<char>(0xFF);
+    segment[1] = static_cast<char>(0xE1);
+    segment[2] = static_cast<char>(length >> 8);
+    segment[3] = static_cast<char>(length & 0xFF);
+    std::memcpy(segment.data() + 4, "Exif\0\0", 6);
+    std::memcpy(segment.data() + HEADER_SIZE, blob.data(), blob.size());
+    return segment;
+}
+
+/*
+Encode exif_data over the TIFF block of an existing segment. When every value
+still fits where it was, Exiv2 updates tiff in place and leaves blob empty
+(wmNonIntrusive); otherwise it builds a new block into blob, keeping the
+original's structure such as maker notes.
+*/
+Exiv2::WriteMethod encode(
+    QByteArray& tiff,
+    Exiv2::Blob& blob,
+    Exiv2::ByteOrder byte_order,
+    const Exiv2::ExifData& exif_data
+) {
+    // Exiv2 may drop entries it cannot write from the data it is given
+    Exiv2::ExifData copy = exif_data;
+    return Exiv2::ExifParser::encode(
+        blob,
+        reinterpret_cast<const Exiv2::byte*>(tiff.data()),
+        static_cast<size_t>(tiff.size()),
+        byte_order,
+        copy
+    );
+}
+
+QString journal_path(const QString& path) {
+    return path + ".journal";
+}
+
+bool sync(QFile& file) {
+    return file.flush() && ::fsync(file.handle()) == 0;
+}
+
+// Make a newly created journal's directory entry durable
+void sync_directory(const QString& path) {
+    int fd = ::open(QFileInfo(path).absolutePath().toLocal8Bit().constData(), O_RDONLY);
+    if (fd < 0) return;
+    ::fsync(fd);
+    ::close(fd);
+}
+
+bool write_journal(const QString& path, qint64 offset, const QByteArray& original) {
+    QFile journal(journal_path(path));
+    if (!journal.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+
+    qint64 size = original.size();
+    journal.write(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    journal.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+    journal.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    journal.write(original);
+    if (!sync(journal)) return false;
+
+    sync_directory(path);
+    return true;
+}
+
+}  // namespace
+
+bool patch_jpeg(const QString& path, const Exiv2::ExifData& exif_data) {
+    TRACE_SCOPE("patch_jpeg");
+
+    recover(path);
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadWrite)) return false;
+
+    std::optional<Layout> layout = scan(file);
+    if (!layout || layout->exif_offset < 0) return false;
+
+    if (!file.seek(layout->exif_offset)) return false;
+    QByteArray original = file.read(layout->exif_size);
+    if (original.size() != layout->exif_size) return false;
+
+    QByteArray tiff = original.mid(HEADER_SIZE);
+    Exiv2::Blob blob;
+    QByteArray segment;
+    if (encode(tiff, blob, layout->byte_order, exif_data) == Exiv2::wmNonIntrusive) {
+        segment = original;
+        segment.replace(HEADER_SIZE, tiff.size(), tiff);
+    }
+    else {
+        // A restructured block still goes in place when it fits the
+        // segment, which is what the padding from rewrite_jpeg is for
+        if (HEADER_SIZE + static_cast<qint64>(blob.size()) > layout->exif_size) {
+            return false;
+        }
+        segment = build_segment(blob, layout->exif_size);
+    }
+
+    // Undo journal first: until it is durable the original is untouched
+    if (!write_journal(path, layout->exif_offset, original)) {
+        QFile::remove(journal_path(path));
+        return false;
+    }
+
+    if (!file.seek(layout->exif_offset) ||
+        file.write(segment) != segment.size() ||
+        !sync(file)) {
+        file.close();
+        recover(path);
+        return false;
+    }
+    file.close();
+
+    QFile::remove(journal_path(path));
+    Stats::count("exif_patched");
+    return true;
+}
+
+bool rewrite_jpeg(const QString& path, const Exiv2::ExifData& exif_data) {
+    TRACE_SCOPE("rewrite_jpeg");
+
+    recover(path);
+
+    QFile input(path);
+    if (!input.open(QIODevice::ReadOnly)) return false;
+
+    std::optional<Layout> layout = scan(input);
+    if (!layout) return false;
+
+    QByteArray tiff;
+    if (layout->exif_offset >= 0) {
+        if (!input.seek(layout->exif_offset + HEADER_SIZE)) return false;
+        tiff = input.read(layout->exif_size - HEADER_SIZE);
+    }
+
+    Exiv2::Blob blob;
+    bool in_place = false;
+    if (tiff.isEmpty()) {
+        Exiv2::ExifParser::encode(blob, layout->byte_order, exif_data);
+    }
+    else if (encode(tiff, blob, layout->byte_order, exif_data) == Exiv2::wmNonIntrusive) {
+        blob.assign(tiff.begin(), tiff.end());
+        in_place = true;
+    }
+    qint64 needed = HEADER_SIZE + static_cast<qint64>(blob.size());
+    if (needed > MAXIMUM_SEGMENT) return false;
+
+    // A block updated in place still carries the old segment's padding, so
+    // it keeps that size rather than growing by another APP1_PADDING
+    qint64 size = in_place
+        ? layout->exif_size
+        : std::min(needed + APP1_PADDING, MAXIMUM_SEGMENT);
+    QByteArray segment = build_segment(blob, size);
+
+    // Replace the old Exif segment where it was, or insert a new one
+    qint64 head = layout->exif_offset >= 0 ? layout->exif_offset : layout->insert_at;
+    qint64 tail = layout->exif_offset >= 0
+        ? layout->exif_offset + layout->exif_size
+        : layout->insert_at;
+
+    // QSaveFile renames over the original only after everything is synced
+    QSaveFile output(path);
+    if (!output.open(QIODevice::WriteOnly)) return false;
+
+    auto copy = [&](qint64 from, qint64 to) {
+        if (!input.seek(from)) return false;
+        while (from < to) {
+            QByteArray chunk = input.read(std::min(COPY_CHUNK, to - from));
+            if (chunk.isEmpty() || output.write(chunk) != chunk.size()) return false;
+            from += chunk.size();
+        }
+        return true;
+    };
+
+    if (!copy(0, head) ||
+        output.write(segment) != segment.size() ||
+        !copy(tail, input.size())) {
+        output.cancelWriting();
+        return false;
+    }
+    if (!output.commit()) return false;
+
+    Stats::count("exif_rewritten");
+    return true;
+}
+
+void recover(const QString& path) {
+    QFile journal(journal_path(path));
+    if (!journal.exists()) return;
+
+    // A journal cut short by a crash means the patch never started
+    bool valid = false;
+    qint64 offset = 0;
+    QByteArray original;
+    if (journal.open(QIODevice::ReadOnly)) {
+        char magic[sizeof(JOURNAL_MAGIC)];
+        qint64 size = 0;
+        valid = journal.read(magic, sizeof(magic)) == sizeof(magic) &&
+            std::memcmp(magic, JOURNAL_MAGIC, sizeof(magic)) == 0 &&
+            journal.read(reinterpret_cast<char*>(&offset), sizeof(offset)) == sizeof(offset) &&
+            journal.read(reinterpret_cast<char*>(&size), sizeof(size)) == sizeof(size) &&
+            size > 0 && size <= MAXIMUM_SEGMENT;
+        if (valid) {
+            original = journal.read(size);
+            valid = original.size() == size;
+        }
+        journal.close();
+    }
+
+    if (valid) {
+        std::cout << "Rolling back interrupted metadata write to "
+                  << path.toStdString() << "\n";
+        QFile file(path);
+        if (!file.open(QIODevice::ReadWrite) ||
+            !file.seek(offset) ||
+            file.write(original) != original.size() ||
+            !sync(file)) {
+            // Keep the journal so the next attempt can retry
+            std::cerr << "Failed to roll back " << path.toStdString() << "\n";
+            return;
+        }
+    }
+    journal.remove();
+}
+
+}  // namespace Exif
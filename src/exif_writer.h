@@ -0,0 +1,36 @@
+#pragma once
+
+#include "pch.h"
+
+namespace Exif {
+
+/*
+Bytes of zero padding reserved after the Exif block whenever the APP1
+segment is rebuilt, so later edits can be patched in place.
+*/
+const int APP1_PADDING = 4096;
+
+/*
+Write exif_data into a JPEG's existing Exif APP1 segment in place, touching
+only that segment. Values are updated where the original block kept them
+when they still fit, otherwise the re-encoded block replaces it within the
+segment's size. The original bytes are saved to a journal next to the file
+first, so an interrupted patch is rolled back by recover(). Returns false
+when the block does not fit or the file has no Exif segment.
+*/
+bool patch_jpeg(const QString& path, const Exiv2::ExifData& exif_data);
+
+/*
+Rebuild a JPEG with a new Exif APP1 segment (plus APP1_PADDING), encoded
+over the old one's structure when there is one, and every other segment
+copied verbatim, through a temporary file and rename. Returns false when the
+block cannot fit in a segment at all.
+*/
+bool rewrite_jpeg(const QString& path, const Exiv2::ExifData& exif_data);
+
+/*
+Roll back a patch interrupted by a crash. Cheap when there is no journal.
+*/
+void recover(const QString& path);
+
+}  // namespace Exif
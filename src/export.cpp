@@ -0,0 +1,310 @@
+#include "export.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "loader.h"
+#include "stats.h"
+#include "trace.h"
+
+namespace Export {
+
+namespace {
+
+/*
+Blocking FIFO with a fixed capacity. close() wakes everyone: pushes fail
+from then on and pops drain what is left.
+*/
+template <typename T>
+class Queue {
+   public:
+    explicit Queue(size_t capacity) : capacity(capacity) {}
+
+    bool push(T item) {
+        std::unique_lock lock(this->mutex);
+        this->space.wait(lock, [this] {
+            return this->closed || this->items.size() < this->capacity;
+        });
+        if (this->closed) return false;
+
+        this->items.push_back(std::move(item));
+        this->available.notify_one();
+        return true;
+    }
+
+    std::optional<T> pop() {
+        std::unique_lock lock(this->mutex);
+        this->available.wait(lock, [this] {
+            return this->closed || !this->items.empty();
+        });
+        if (this->items.empty()) return std::nullopt;
+
+        T item = std::move(this->items.front());
+        this->items.pop_front();
+        this->space.notify_one();
+        return item;
+    }
+
+    void close() {
+        std::lock_guard lock(this->mutex);
+        this->closed = true;
+        this->available.notify_all();
+        this->space.notify_all();
+    }
+
+   private:
+    size_t capacity;
+    std::mutex mutex;
+    std::condition_variable available;
+    std::condition_variable space;
+    std::deque<T> items;
+    bool closed = false;
+};
+
+struct Item {
+    QString source;
+    QString destination;
+    QImage image;
+    int orientation = 1;
+    std::unique_ptr<Exiv2::Image> metadata;
+};
+
+/*
+Pick an output path per file up front, so files sharing a name in
+different folders do not overwrite each other.
+*/
+QStringList output_paths(const QStringList& files, const Options& options) {
+    QDir directory(options.directory);
+    QSet<QString> taken;
+    QStringList paths;
+    for (const QString& file : files) {
+        QString base = QFileInfo(file).completeBaseName();
+        QString name = base + "." + options.format;
+        for (int i = 1; taken.contains(name); ++i) {
+            name = QString("%1_%2.%3").arg(base).arg(i).arg(options.format);
+        }
+        taken.insert(name);
+        paths.append(directory.filePath(name));
+    }
+    return paths;
+}
+
+void copy_metadata(Item& item, const QSize& size) {
+    if (!item.metadata) return;
+
+    auto output = Exiv2::ImageFactory::open(item.destination.toStdString());
+    Exiv2::ExifData exif_data = item.metadata->exifData();
+    if (!exif_data.empty()) {
+        // Web copies do not need a second, smaller copy inside them
+        Exiv2::ExifThumb(exif_data).erase();
+        exif_data["Exif.Image.Orientation"] = uint16_t{1};
+        if (exif_data.findKey(Exiv2::ExifKey("Exif.Photo.PixelXDimension")) != exif_data.end()) {
+            exif_data["Exif.Photo.PixelXDimension"] = static_cast<uint32_t>(size.width());
+            exif_data["Exif.Photo.PixelYDimension"] = static_cast<uint32_t>(size.height());
+        }
+    }
+    output->setExifData(exif_data);
+    output->setIptcData(item.metadata->iptcData());
+    output->setXmpData(item.metadata->xmpData());
+    output->writeMetadata();
+}
+
+int default_workers(int requested, int share) {
+    if (requested > 0) return requested;
+    int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    return std::max(1, cores * share / 8);
+}
+
+}  // namespace
+
+double Result::images_per_second() const {
+    return this->seconds > 0 ? this->exported / this->seconds : 0.0;
+}
+
+Result run(
+    const QStringList& files,
+    const Options& options,
+    const std::function<void(int, int)>& progress,
+    const std::atomic<bool>* cancelled
+) {
+    TRACE_SCOPE("export");
+
+    Result result;
+    if (files.isEmpty() || !QDir().mkpath(options.directory)) return result;
+
+    // XMP parsing is only thread-safe once initialized
+    Exiv2::XmpParser::initialize();
+
+    // Decoding dominates, and scaling is cheaper than encoding
+    const int decoders = default_workers(options.decoders, 4);
+    const int resizers = default_workers(options.resizers, 2);
+    const int encoders = default_workers(options.encoders, 2);
+
+    const QStringList destinations = output_paths(files, options);
+    const QByteArray format = options.format == "webp" ? "webp" : "jpg";
+    const QSize bounds(options.size, options.size);
+    const int total = static_cast<int>(files.size());
+
+    // Capacities are what bounds memory: each slot may hold a full frame
+    Queue<Item> decoded(static_cast<size_t>(resizers));
+    Queue<Item> resized(static_cast<size_t>(encoders) * 2);
+
+    std::atomic<int> next{0};
+    std::atomic<int> exported{0};
+    std::atomic<int> failed{0};
+    std::atomic<int> decoding{decoders};
+    std::atomic<int> resizing{resizers};
+
+    auto is_cancelled = [cancelled] { return cancelled && *cancelled; };
+    auto fail = [&](const Item& item, const char* reason) {
+        std::cerr << "Failed to export " << item.source.toStdString() << ": "
+                  << reason << "\n";
+        failed++;
+        if (progress) progress(exported + failed, total);
+    };
+
+    auto decode = [&] {
+        Trace::set_thread_name("Export decode");
+        for (int i = next++; i < total && !is_cancelled(); i = next++) {
+            Item item;
+            item.source = files[i];
+            item.destination = destinations[i];
+
+            try {
+                item.metadata = Exiv2::ImageFactory::open(item.source.toStdString());
+                item.metadata->readMetadata();
+                item.orientation = Image::read_orientation(
+                    item.source, item.metadata->exifData()
+                );
+            }
+            catch (const std::exception&) {
+                // Still export the pixels of files Exiv2 cannot read
+                item.metadata.reset();
+            }
+
+            try {
+                TRACE_SCOPE("export_decode");
+                item.image = Image::read_image(item.source);
+            }
+            catch (const std::exception& e) {
+                fail(item, e.what());
+                continue;
+            }
+            if (item.image.isNull()) {
+                fail(item, "decode failed");
+                continue;
+            }
+            if (!decoded.push(std::move(item))) break;
+        }
+        if (--decoding == 0) decoded.close();
+    };
+
+    auto resize = [&] {
+        Trace::set_thread_name("Export resize");
+        while (std::optional<Item> item = decoded.pop()) {
+            {
+                TRACE_SCOPE("export_resize");
+                STAGE_SCOPE(Stats::Stage::SCALE);
+                QSize fit = Image::swaps_axes(item->orientation) ? bounds.transposed() : bounds;
+                if (item->image.width() > fit.width() || item->image.height() > fit.height()) {
+                    item->image = item->image.scaled(
+                        fit, Qt::KeepAspectRatio, Qt::SmoothTransformation
+                    );
+                }
+                item->image = item->image.transformed(
+                    Image::orientation_transform(item->orientation)
+                );
+            }
+            if (!resized.push(std::move(*item))) break;
+        }
+        if (--resizing == 0) resized.close();
+    };
+
+    auto encode = [&] {
+        Trace::set_thread_name("Export encode");
+        while (std::optional<Item> item = resized.pop()) {
+            TRACE_SCOPE("export_encode");
+            STAGE_SCOPE(Stats::Stage::WRITE);
+
+            QSaveFile file(item->destination);
+            QImageWriter writer(&file, format);
+            writer.setQuality(options.quality);
+            if (!file.open(QIODevice::WriteOnly) ||
+                !writer.write(item->image) ||
+                !file.commit()) {
+                fail(*item, writer.errorString().toUtf8().constData());
+                continue;
+            }
+
+            try {
+                copy_metadata(*item, item->image.size());
+            }
+            catch (const std::exception& e) {
+                std::cerr << "Exported " << item->destination.toStdString()
+                          << " without metadata: " << e.what() << "\n";
+            }
+            exported++;
+            if (progress) progress(exported + failed, total);
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < decoders; ++i) threads.emplace_back(decode);
+        for (int i = 0; i < resizers; ++i) threads.emplace_back(resize);
+        for (int i = 0; i < encoders; ++i) threads.emplace_back(encode);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    result.exported = exported;
+    result.failed = failed;
+    result.seconds = elapsed.count();
+    Stats::count("exported", static_cast<uint64_t>(result.exported));
+    return result;
+}
+
+Engine::Engine(QObject* parent) : QObject(parent) {}
+
+Engine::~Engine() {
+    this->cancel();
+}
+
+void Engine::start(const QStringList& files, const Options& options) {
+    this->cancel();
+    this->cancelled = false;
+
+    this->worker = QThread::create([this, files, options]() {
+        Trace::set_thread_name("Export");
+        auto start = std::chrono::steady_clock::now();
+        Result result = run(
+            files,
+            options,
+            [this, start](int done, int total) {
+                std::chrono::duration<double> elapsed =
+                    std::chrono::steady_clock::now() - start;
+                emit this->progress(done, total, done / std::max(elapsed.count(), 1e-3));
+            },
+            &this->cancelled
+        );
+        emit this->finished(result.exported, result.failed, result.images_per_second());
+    });
+    this->worker->start(QThread::LowPriority);
+}
+
+void Engine::cancel() {
+    if (!this->worker) return;
+
+    this->cancelled = true;
+    this->worker->wait();
+    delete this->worker;
+    this->worker = nullptr;
+}
+
+bool Engine::is_running() const {
+    return this->worker && this->worker->isRunning();
+}
+
+}  // namespace Export
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "pch.h"
+
+#include <atomic>
+
+namespace Export {
+
+struct Options {
+    QString directory;
+    // Longest edge of the output in pixels
+    int size = 2048;
+    // "jpg" or "webp"
+    QString format = "jpg";
+    int quality = 85;
+
+    // Workers per stage; 0 picks a share of the available cores
+    int decoders = 0;
+    int resizers = 0;
+    int encoders = 0;
+};
+
+struct Result {
+    int exported = 0;
+    int failed = 0;
+    double seconds = 0;
+
+    double images_per_second() const;
+};
+
+/*
+Export web sized copies of files into options.directory through a three
+stage pipeline: decode, downscale and encode. Each stage has its own worker
+threads, and the stages are joined by small bounded queues, so at most a
+handful of full resolution frames are resident and a slow stage applies
+backpressure instead of piling up images. The output carries the source's
+Exif, IPTC and XMP, with the orientation applied to the pixels and the
+thumbnail dropped. Blocks until done; progress is called from worker
+threads.
+*/
+Result run(
+    const QStringList& files,
+    const Options& options,
+    const std::function<void(int, int)>& progress = nullptr,
+    const std::atomic<bool>* cancelled = nullptr
+);
+
+/*
+Runs an export on a background thread for the GUI.
+*/
+class Engine : public QObject {
+    Q_OBJECT
+
+   public:
+    explicit Engine(QObject* parent = nullptr);
+    ~Engine() override;
+
+    void start(const QStringList& files, const Options& options);
+    void cancel();
+    bool is_running() const;
+
+   signals:
+    void progress(int done, int total, double images_per_second);
+    void finished(int exported, int failed, double images_per_second);
+
+   private:
+    QThread* worker = nullptr;
+    std::atomic<bool> cancelled{false};
+};
+
+}  // namespace Export
@@ -0,0 +1,187 @@
+#include "histogram.h"
+
+#include "trace.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HISTOGRAM_X86 1
+#endif
+
+namespace Histogram {
+
+namespace {
+
+const uint32_t RED_WEIGHT = 54;
+const uint32_t GREEN_WEIGHT = 183;
+const uint32_t BLUE_WEIGHT = 19;
+
+inline void count_pixel(Bins& bins, uint32_t pixel) {
+    uint32_t red = (pixel >> 16) & 0xFF;
+    uint32_t green = (pixel >> 8) & 0xFF;
+    uint32_t blue = pixel & 0xFF;
+    bins.red[red]++;
+    bins.green[green]++;
+    bins.blue[blue]++;
+    bins.luma[(RED_WEIGHT * red + GREEN_WEIGHT * green + BLUE_WEIGHT * blue) >> 8]++;
+}
+
+}  // namespace
+
+Bins compute_scalar(const QImage& image) {
+    Bins bins;
+    for (int y = 0; y < image.height(); ++y) {
+        const uint32_t* pixels = reinterpret_cast<const uint32_t*>(image.constScanLine(y));
+        for (int x = 0; x < image.width(); ++x) count_pixel(bins, pixels[x]);
+    }
+    return bins;
+}
+
+#ifdef HISTOGRAM_X86
+
+__attribute__((target("avx2")))
+Bins compute_avx2(const QImage& image) {
+    // Even and odd lanes count into separate copies, merged at the end
+    std::array<Bins, 2> copies;
+
+    const __m256i mask = _mm256_set1_epi32(0xFF);
+    // Products and their sum stay below 2^16, so 16-bit multiplies suffice
+    const __m256i red_weight = _mm256_set1_epi32(RED_WEIGHT);
+    const __m256i green_weight = _mm256_set1_epi32(GREEN_WEIGHT);
+    const __m256i blue_weight = _mm256_set1_epi32(BLUE_WEIGHT);
+
+    alignas(32) uint32_t red[8];
+    alignas(32) uint32_t green[8];
+    alignas(32) uint32_t blue[8];
+    alignas(32) uint32_t luma[8];
+
+    const int width = image.width();
+    for (int y = 0; y < image.height(); ++y) {
+        const uint32_t* pixels = reinterpret_cast<const uint32_t*>(image.constScanLine(y));
+
+        int x = 0;
+        for (; x + 8 <= width; x += 8) {
+            __m256i pixel = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pixels + x));
+            __m256i b = _mm256_and_si256(pixel, mask);
+            __m256i g = _mm256_and_si256(_mm256_srli_epi32(pixel, 8), mask);
+            __m256i r = _mm256_and_si256(_mm256_srli_epi32(pixel, 16), mask);
+            __m256i l = _mm256_srli_epi32(
+                _mm256_add_epi16(
+                    _mm256_add_epi16(
+                        _mm256_mullo_epi16(r, red_weight),
+                        _mm256_mullo_epi16(g, green_weight)
+                    ),
+                    _mm256_mullo_epi16(b, blue_weight)
+                ),
+                8
+            );
+
+            _mm256_store_si256(reinterpret_cast<__m256i*>(red), r);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(green), g);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(blue), b);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(luma), l);
+
+            for (int lane = 0; lane < 8; ++lane) {
+                Bins& bins = copies[static_cast<size_t>(lane & 1)];
+                bins.red[red[lane]]++;
+                bins.green[green[lane]]++;
+                bins.blue[blue[lane]]++;
+                bins.luma[luma[lane]]++;
+            }
+        }
+        for (; x < width; ++x) count_pixel(copies[0], pixels[x]);
+    }
+
+    Bins& bins = copies[0];
+    for (size_t i = 0; i < BINS; ++i) {
+        bins.red[i] += copies[1].red[i];
+        bins.green[i] += copies[1].green[i];
+        bins.blue[i] += copies[1].blue[i];
+        bins.luma[i] += copies[1].luma[i];
+    }
+    return bins;
+}
+
+bool has_avx2() {
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+#else
+
+Bins compute_avx2(const QImage& image) {
+    return compute_scalar(image);
+}
+
+bool has_avx2() {
+    return false;
+}
+
+#endif
+
+Bins compute(const QImage& image) {
+    TRACE_SCOPE("compute_histogram");
+
+    QImage pixels = image;
+    if (pixels.format() != QImage::Format_RGB32 &&
+        pixels.format() != QImage::Format_ARGB32) {
+        pixels = pixels.convertToFormat(QImage::Format_RGB32);
+    }
+    return has_avx2() ? compute_avx2(pixels) : compute_scalar(pixels);
+}
+
+Widget::Widget(QWidget* parent) : QWidget(parent) {
+    this->setFixedSize(290, 100);
+}
+
+void Widget::set_bins(const Bins& bins) {
+    this->bins = bins;
+    this->update();
+}
+
+void Widget::paintEvent(QPaintEvent*) {
+    QPainter painter(this);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.fillRect(this->rect(), QColor(0, 0, 0, 12));
+    if (!this->bins) return;
+
+    uint32_t peak = 1;
+    for (size_t i = 1; i + 1 < BINS; ++i) {
+        peak = std::max({
+            peak,
+            this->bins->red[i],
+            this->bins->green[i],
+            this->bins->blue[i],
+            this->bins->luma[i]
+        });
+    }
+
+    const double width = this->width();
+    const double height = this->height();
+    auto curve = [&](const std::array<uint32_t, BINS>& counts) {
+        QPainterPath path(QPointF(0, height));
+        for (size_t i = 0; i < BINS; ++i) {
+            double value = std::min(1.0, static_cast<double>(counts[i]) / peak);
+            path.lineTo(
+                static_cast<double>(i) * width / (BINS - 1),
+                height - value * height
+            );
+        }
+        path.lineTo(width, height);
+        path.closeSubpath();
+        return path;
+    };
+
+    painter.setPen(Qt::NoPen);
+    painter.setBrush(QColor(128, 128, 128, 110));
+    painter.drawPath(curve(this->bins->luma));
+
+    painter.setBrush(Qt::NoBrush);
+    painter.setPen(QPen(QColor(220, 40, 40, 200), 1));
+    painter.drawPath(curve(this->bins->red));
+    painter.setPen(QPen(QColor(40, 170, 40, 200), 1));
+    painter.drawPath(curve(this->bins->green));
+    painter.setPen(QPen(QColor(40, 80, 220, 200), 1));
+    painter.drawPath(curve(this->bins->blue));
+}
+
+}  // namespace Histogram
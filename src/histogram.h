@@ -0,0 +1,61 @@
+#pragma once
+
+#include "pch.h"
+
+#include <array>
+
+namespace Histogram {
+
+const int BINS = 256;
+
+struct Bins {
+    std::array<uint32_t, BINS> red{};
+    std::array<uint32_t, BINS> green{};
+    std::array<uint32_t, BINS> blue{};
+    // Rec. 709 weights in 8.8 fixed point
+    std::array<uint32_t, BINS> luma{};
+
+    bool operator==(const Bins& other) const = default;
+};
+
+/*
+Reference implementation, one pixel at a time. image must be
+Format_RGB32 or Format_ARGB32.
+*/
+Bins compute_scalar(const QImage& image);
+
+/*
+Extracts channels and luma for eight pixels per step with AVX2, then counts
+into interleaved sub-histograms so consecutive pixels do not serialize on
+the same counter. Only call when has_avx2() is true.
+*/
+Bins compute_avx2(const QImage& image);
+
+bool has_avx2();
+
+/*
+Convert image to 32-bit RGB if needed and dispatch to the fastest kernel the
+CPU supports. Safe to call from worker threads.
+*/
+Bins compute(const QImage& image);
+
+/*
+Overlaid RGB and luma curves, normalized to the tallest non-clipped bin so a
+pure black or white border does not flatten everything else.
+*/
+class Widget : public QWidget {
+    Q_OBJECT
+
+   public:
+    explicit Widget(QWidget* parent = nullptr);
+
+    void set_bins(const Bins& bins);
+
+   protected:
+    void paintEvent(QPaintEvent* event) override;
+
+   private:
+    std::optional<Bins> bins;
+};
+
+}  // namespace Histogram
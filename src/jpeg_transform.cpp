@@ -0,0 +1,496 @@
+#include "jpeg_transform.h"
+
+#include <csetjmp>
+#include <cstdio>
+
+#include <jpeglib.h>
+
+#include "loader.h"
+#include "scheduler.h"
+#include "trace.h"
+
+namespace Transform {
+
+namespace {
+
+const QSize THUMBNAIL_SIZE(160, 160);
+
+/*
+A signed permutation matrix acting on pixel coordinates:
+x' = xx * x + xy * y and y' = yx * x + yy * y.
+*/
+struct Matrix {
+    int xx, xy, yx, yy;
+
+    Matrix operator*(const Matrix& right) const {
+        return {
+            xx * right.xx + xy * right.yx,
+            xx * right.xy + xy * right.yy,
+            yx * right.xx + yy * right.yx,
+            yx * right.xy + yy * right.yy
+        };
+    }
+};
+
+const Matrix IDENTITY{1, 0, 0, 1};
+const Matrix ROTATE_90{0, -1, 1, 0};
+const Matrix ROTATE_180{-1, 0, 0, -1};
+const Matrix ROTATE_270{0, 1, -1, 0};
+const Matrix FLIP_HORIZONTAL{-1, 0, 0, 1};
+const Matrix FLIP_VERTICAL{1, 0, 0, -1};
+const Matrix TRANSPOSE{0, 1, 1, 0};
+const Matrix TRANSVERSE{0, -1, -1, 0};
+
+Matrix operation_matrix(Operation operation) {
+    switch (operation) {
+        case Operation::ROTATE_90: return ROTATE_90;
+        case Operation::ROTATE_180: return ROTATE_180;
+        case Operation::ROTATE_270: return ROTATE_270;
+        case Operation::FLIP_HORIZONTAL: return FLIP_HORIZONTAL;
+        case Operation::FLIP_VERTICAL: return FLIP_VERTICAL;
+        default: return IDENTITY;
+    }
+}
+
+// The transform that makes an image stored with orientation upright
+Matrix orientation_matrix(int orientation) {
+    switch (orientation) {
+        case 2: return FLIP_HORIZONTAL;
+        case 3: return ROTATE_180;
+        case 4: return FLIP_VERTICAL;
+        case 5: return TRANSPOSE;
+        case 6: return ROTATE_90;
+        case 7: return TRANSVERSE;
+        case 8: return ROTATE_270;
+        default: return IDENTITY;
+    }
+}
+
+/*
+Every matrix is an optional transpose followed by negating output axes,
+which is the form the block shuffle works in.
+*/
+struct Geometry {
+    bool transpose;
+    bool negate_x;
+    bool negate_y;
+    JDIMENSION width;
+    JDIMENSION height;
+};
+
+Geometry decompose(const Matrix& matrix) {
+    Geometry geometry{};
+    geometry.transpose = matrix.xx == 0;
+    geometry.negate_x = (geometry.transpose ? matrix.xy : matrix.xx) < 0;
+    geometry.negate_y = (geometry.transpose ? matrix.yx : matrix.yy) < 0;
+    return geometry;
+}
+
+JDIMENSION div_round_up(JDIMENSION value, JDIMENSION divisor) {
+    return (value + divisor - 1) / divisor;
+}
+
+JDIMENSION round_up(JDIMENSION value, JDIMENSION multiple) {
+    return div_round_up(value, multiple) * multiple;
+}
+
+struct ErrorManager {
+    jpeg_error_mgr base;
+    std::jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+};
+
+void error_exit(j_common_ptr info) {
+    auto* manager = reinterpret_cast<ErrorManager*>(info->err);
+    (*info->err->format_message)(info, manager->message);
+    std::longjmp(manager->jump, 1);
+}
+
+void emit_message(j_common_ptr, int) {
+    // Corrupt data warnings would otherwise go to stderr per scanline
+}
+
+// Output blocks of a component, padded to whole MCUs like libjpeg allocates
+JDIMENSION padded_blocks(
+    JDIMENSION pixels,
+    int samples,
+    int max_samples
+) {
+    JDIMENSION blocks = div_round_up(
+        pixels * static_cast<JDIMENSION>(samples),
+        static_cast<JDIMENSION>(max_samples * DCTSIZE)
+    );
+    return round_up(blocks, static_cast<JDIMENSION>(samples));
+}
+
+void transform_block(const JCOEF* input, JCOEF* output, const Geometry& geometry) {
+    for (int v = 0; v < DCTSIZE; ++v) {
+        for (int u = 0; u < DCTSIZE; ++u) {
+            JCOEF value = geometry.transpose
+                ? input[u * DCTSIZE + v]
+                : input[v * DCTSIZE + u];
+            // Mirroring an axis flips the sign of its odd frequencies
+            bool negate = (geometry.negate_x && (u & 1)) != (geometry.negate_y && (v & 1));
+            output[v * DCTSIZE + u] = static_cast<JCOEF>(negate ? -value : value);
+        }
+    }
+}
+
+/*
+Decode coefficients from input, shuffle and transform them, and encode them
+to a malloc'd buffer. Only plain C locals live here because libjpeg errors
+longjmp out of it.
+*/
+bool transform_coefficients(
+    const unsigned char* input,
+    unsigned long input_size,
+    Geometry& geometry,
+    unsigned char** output,
+    unsigned long* output_size,
+    char* error
+) {
+    jpeg_decompress_struct source;
+    jpeg_compress_struct destination;
+    // Shared by both objects so a single setjmp covers either failing
+    ErrorManager manager;
+    volatile bool destination_created = false;
+
+    source.err = jpeg_std_error(&manager.base);
+    destination.err = &manager.base;
+    manager.base.error_exit = error_exit;
+    manager.base.emit_message = emit_message;
+    manager.message[0] = '\0';
+
+    if (setjmp(manager.jump)) {
+        std::snprintf(error, JMSG_LENGTH_MAX, "%s", manager.message);
+        if (destination_created) jpeg_destroy_compress(&destination);
+        jpeg_destroy_decompress(&source);
+        return false;
+    }
+
+    jpeg_create_decompress(&source);
+    jpeg_mem_src(&source, input, input_size);
+    jpeg_save_markers(&source, JPEG_COM, 0xFFFF);
+    for (int marker = 0; marker < 16; ++marker) {
+        jpeg_save_markers(&source, JPEG_APP0 + marker, 0xFFFF);
+    }
+    jpeg_read_header(&source, TRUE);
+
+    const int max_h = source.max_h_samp_factor;
+    const int max_v = source.max_v_samp_factor;
+    const int out_max_h = geometry.transpose ? max_v : max_h;
+    const int out_max_v = geometry.transpose ? max_h : max_v;
+
+    geometry.width = geometry.transpose ? source.image_height : source.image_width;
+    geometry.height = geometry.transpose ? source.image_width : source.image_height;
+
+    // A mirrored axis would move its partial MCU to the leading edge, where
+    // JPEG cannot represent it, so it is dropped
+    if (geometry.negate_x) {
+        JDIMENSION mcu = static_cast<JDIMENSION>(out_max_h * DCTSIZE);
+        geometry.width = geometry.width / mcu * mcu;
+    }
+    if (geometry.negate_y) {
+        JDIMENSION mcu = static_cast<JDIMENSION>(out_max_v * DCTSIZE);
+        geometry.height = geometry.height / mcu * mcu;
+    }
+    if (geometry.width == 0 || geometry.height == 0) {
+        std::snprintf(error, JMSG_LENGTH_MAX, "Image is smaller than one MCU");
+        jpeg_destroy_decompress(&source);
+        return false;
+    }
+
+    // Destination arrays must be requested before the source realizes its own
+    auto* arrays = static_cast<jvirt_barray_ptr*>((*source.mem->alloc_small)(
+        reinterpret_cast<j_common_ptr>(&source),
+        JPOOL_IMAGE,
+        sizeof(jvirt_barray_ptr) * static_cast<size_t>(source.num_components)
+    ));
+    for (int c = 0; c < source.num_components; ++c) {
+        const jpeg_component_info& component = source.comp_info[c];
+        int h = geometry.transpose ? component.v_samp_factor : component.h_samp_factor;
+        int v = geometry.transpose ? component.h_samp_factor : component.v_samp_factor;
+        arrays[c] = (*source.mem->request_virt_barray)(
+            reinterpret_cast<j_common_ptr>(&source),
+            JPOOL_IMAGE,
+            FALSE,
+            padded_blocks(geometry.width, h, out_max_h),
+            padded_blocks(geometry.height, v, out_max_v),
+            static_cast<JDIMENSION>(v)
+        );
+    }
+
+    jvirt_barray_ptr* source_arrays = jpeg_read_coefficients(&source);
+
+    jpeg_create_compress(&destination);
+    destination_created = true;
+    jpeg_mem_dest(&destination, output, output_size);
+    jpeg_copy_critical_parameters(&source, &destination);
+    destination.image_width = geometry.width;
+    destination.image_height = geometry.height;
+    destination.optimize_coding = TRUE;
+    if (source.progressive_mode) jpeg_simple_progression(&destination);
+
+    if (geometry.transpose) {
+        for (int c = 0; c < destination.num_components; ++c) {
+            jpeg_component_info& component = destination.comp_info[c];
+            std::swap(component.h_samp_factor, component.v_samp_factor);
+        }
+        // Quantization tables are indexed by frequency, so they transpose too
+        for (JQUANT_TBL* table : destination.quant_tbl_ptrs) {
+            if (!table) continue;
+            for (int row = 0; row < DCTSIZE; ++row) {
+                for (int column = 0; column < row; ++column) {
+                    std::swap(
+                        table->quantval[row * DCTSIZE + column],
+                        table->quantval[column * DCTSIZE + row]
+                    );
+                }
+            }
+        }
+    }
+
+    jpeg_write_coefficients(&destination, arrays);
+
+    for (jpeg_saved_marker_ptr marker = source.marker_list; marker; marker = marker->next) {
+        bool jfif = marker->marker == JPEG_APP0 && marker->data_length >= 5 &&
+            std::memcmp(marker->data, "JFIF", 5) == 0;
+        bool adobe = marker->marker == JPEG_APP0 + 14 && marker->data_length >= 5 &&
+            std::memcmp(marker->data, "Adobe", 5) == 0;
+        if ((jfif && destination.write_JFIF_header) ||
+            (adobe && destination.write_Adobe_marker)) {
+            continue;
+        }
+        jpeg_write_marker(&destination, marker->marker, marker->data, marker->data_length);
+    }
+
+    for (int c = 0; c < source.num_components; ++c) {
+        const jpeg_component_info& component = source.comp_info[c];
+        int h = geometry.transpose ? component.v_samp_factor : component.h_samp_factor;
+        int v = geometry.transpose ? component.h_samp_factor : component.v_samp_factor;
+        JDIMENSION out_width = padded_blocks(geometry.width, h, out_max_h);
+        JDIMENSION out_height = padded_blocks(geometry.height, v, out_max_v);
+        JDIMENSION source_width = round_up(
+            component.width_in_blocks, static_cast<JDIMENSION>(component.h_samp_factor)
+        );
+        JDIMENSION source_height = round_up(
+            component.height_in_blocks, static_cast<JDIMENSION>(component.v_samp_factor)
+        );
+
+        for (JDIMENSION y = 0; y < out_height; ++y) {
+            JBLOCKROW row = (*source.mem->access_virt_barray)(
+                reinterpret_cast<j_common_ptr>(&source), arrays[c], y, 1, TRUE
+            )[0];
+
+            for (JDIMENSION x = 0; x < out_width; ++x) {
+                // Undo the negation, then the transpose, to find the source
+                JDIMENSION qx = geometry.negate_x ? out_width - 1 - x : x;
+                JDIMENSION qy = geometry.negate_y ? out_height - 1 - y : y;
+                JDIMENSION sx = geometry.transpose ? qy : qx;
+                JDIMENSION sy = geometry.transpose ? qx : qy;
+
+                if (sx >= source_width || sy >= source_height) {
+                    std::memset(row[x], 0, sizeof(JBLOCK));
+                    continue;
+                }
+                JBLOCKROW source_row = (*source.mem->access_virt_barray)(
+                    reinterpret_cast<j_common_ptr>(&source), source_arrays[c], sy, 1, FALSE
+                )[0];
+                transform_block(source_row[sx], row[x], geometry);
+            }
+        }
+    }
+
+    jpeg_finish_compress(&destination);
+    jpeg_destroy_compress(&destination);
+    jpeg_finish_decompress(&source);
+    jpeg_destroy_decompress(&source);
+    return true;
+}
+
+/*
+Regenerate the Exif thumbnail from the transformed JPEG, using libjpeg's
+DCT scaling through QImageReader.
+*/
+void refresh_thumbnail(Exiv2::ExifData& exif_data, const QByteArray& jpeg) {
+    Exiv2::ExifThumb thumbnail(exif_data);
+    if (std::string(thumbnail.mimeType()).empty()) return;
+
+    QByteArray source = jpeg;
+    QBuffer input(&source);
+    QImageReader reader(&input);
+    QSize size = reader.size();
+    reader.setScaledSize(size.scaled(THUMBNAIL_SIZE, Qt::KeepAspectRatio));
+    QImage image = reader.read();
+    if (image.isNull()) return;
+
+    QByteArray encoded;
+    QBuffer output(&encoded);
+    output.open(QIODevice::WriteOnly);
+    if (!image.save(&output, "JPG", 85)) return;
+
+    thumbnail.setJpegThumbnail(
+        reinterpret_cast<const Exiv2::byte*>(encoded.constData()),
+        static_cast<size_t>(encoded.size())
+    );
+}
+
+}  // namespace
+
+std::optional<Operation> parse_operation(const std::string& name) {
+    if (name == "auto") return Operation::AUTO;
+    if (name == "90") return Operation::ROTATE_90;
+    if (name == "180") return Operation::ROTATE_180;
+    if (name == "270") return Operation::ROTATE_270;
+    if (name == "flip-h") return Operation::FLIP_HORIZONTAL;
+    if (name == "flip-v") return Operation::FLIP_VERTICAL;
+    return std::nullopt;
+}
+
+bool apply(const QString& path, Operation operation) {
+    TRACE_SCOPE("jpeg_transform");
+
+    QString suffix = QFileInfo(path).suffix().toLower();
+    if (suffix != "jpg" && suffix != "jpeg") {
+        std::cerr << "Lossless transforms need a JPEG: " << path.toStdString() << "\n";
+        return false;
+    }
+
+    try {
+        auto image = Exiv2::ImageFactory::open(path.toStdString());
+        image->readMetadata();
+        int orientation = Image::read_orientation(path, image->exifData());
+
+        // What is on screen is the stored image after its orientation, so the
+        // operation applies on top of that
+        Matrix matrix = operation_matrix(operation) * orientation_matrix(orientation);
+        if (matrix.xx == 1 && matrix.yy == 1) {
+            if (orientation == 1) return true;
+
+            // The pixels are already stored upright; only the tag that
+            // turned them is wrong
+            Image::write_image(path, {{"Exif.Image.Orientation", "1"}}, std::move(image));
+            return true;
+        }
+
+        QByteArray input;
+        {
+            QFile file(path);
+            if (!file.open(QIODevice::ReadOnly)) return false;
+            input = file.readAll();
+        }
+
+        Geometry geometry = decompose(matrix);
+        unsigned char* buffer = nullptr;
+        unsigned long size = 0;
+        char error[JMSG_LENGTH_MAX] = {};
+        bool transformed = transform_coefficients(
+            reinterpret_cast<const unsigned char*>(input.constData()),
+            static_cast<unsigned long>(input.size()),
+            geometry,
+            &buffer,
+            &size,
+            error
+        );
+        QByteArray output;
+        if (buffer) {
+            output = QByteArray(reinterpret_cast<const char*>(buffer), static_cast<qsizetype>(size));
+            std::free(buffer);
+        }
+        if (!transformed) {
+            std::cerr << "Failed to transform " << path.toStdString() << ": "
+                      << error << "\n";
+            return false;
+        }
+
+        QSaveFile file(path);
+        if (!file.open(QIODevice::WriteOnly) ||
+            file.write(output) != output.size() ||
+            !file.commit()) {
+            return false;
+        }
+
+        image = Exiv2::ImageFactory::open(path.toStdString());
+        image->readMetadata();
+        Exiv2::ExifData& exif_data = image->exifData();
+        if (exif_data.empty()) return true;
+
+        std::map<std::string, std::string> metadata = {
+            {"Exif.Image.Orientation", "1"}
+        };
+        if (exif_data.findKey(Exiv2::ExifKey("Exif.Photo.PixelXDimension")) != exif_data.end()) {
+            metadata["Exif.Photo.PixelXDimension"] = std::to_string(geometry.width);
+            metadata["Exif.Photo.PixelYDimension"] = std::to_string(geometry.height);
+        }
+        refresh_thumbnail(exif_data, output);
+        Image::write_image(path, metadata, std::move(image));
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Failed to transform " << path.toStdString() << ": "
+                  << e.what() << "\n";
+        return false;
+    }
+    return true;
+}
+
+int apply_all(
+    const QStringList& files,
+    Operation operation,
+    const std::function<void(int, int)>& progress,
+    const std::atomic<bool>* cancelled
+) {
+    TRACE_SCOPE("jpeg_transform_batch");
+
+    // XMP parsing is only thread-safe once initialized
+    Exiv2::XmpParser::initialize();
+
+    const int total = static_cast<int>(files.size());
+    std::atomic<int> done{0};
+    std::atomic<int> failed{0};
+
+    Scheduler::parallel_for(total, Scheduler::Priority::BACKGROUND, [&](int i) {
+        if (cancelled && *cancelled) return;
+        if (!apply(files[i], operation)) failed++;
+        int count = ++done;
+        if (progress) progress(count, total);
+    });
+    return failed;
+}
+
+Batch::Batch(QObject* parent) : QObject(parent) {}
+
+Batch::~Batch() {
+    this->cancel();
+}
+
+void Batch::start(const QStringList& files, Operation operation) {
+    this->cancel();
+    this->cancelled = false;
+
+    this->worker = QThread::create([this, files, operation]() {
+        Trace::set_thread_name("Transform");
+        int failed = apply_all(
+            files,
+            operation,
+            [this](int done, int total) { emit this->progress(done, total); },
+            &this->cancelled
+        );
+        emit this->finished(files, failed);
+    });
+    this->worker->start(QThread::LowPriority);
+}
+
+void Batch::cancel() {
+    if (!this->worker) return;
+
+    this->cancelled = true;
+    this->worker->wait();
+    delete this->worker;
+    this->worker = nullptr;
+}
+
+bool Batch::is_running() const {
+    return this->worker && this->worker->isRunning();
+}
+
+}  // namespace Transform
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "pch.h"
+
+#include <atomic>
+
+namespace Transform {
+
+enum class Operation {
+    // Bake the EXIF orientation into the pixels
+    AUTO,
+    ROTATE_90,
+    ROTATE_180,
+    ROTATE_270,
+    FLIP_HORIZONTAL,
+    FLIP_VERTICAL
+};
+
+/*
+Parse a command line name: auto, 90, 180, 270, flip-h or flip-v.
+*/
+std::optional<Operation> parse_operation(const std::string& name);
+
+/*
+Losslessly rotate or flip a JPEG, as seen on screen, by rearranging its DCT
+coefficients the way jpegtran does; nothing is decoded or recompressed. The
+current EXIF orientation is folded into the pixels and reset to 1, and the
+Exif thumbnail and pixel dimensions are refreshed through Image::write_image.
+Edges that would end up as partial MCUs on the left or top are trimmed, as
+with jpegtran -trim. Safe to call from worker threads.
+*/
+bool apply(const QString& path, Operation operation);
+
+/*
+Apply an operation to every JPEG in files in parallel, blocking until done.
+Returns the number of files that failed.
+*/
+int apply_all(
+    const QStringList& files,
+    Operation operation,
+    const std::function<void(int, int)>& progress = nullptr,
+    const std::atomic<bool>* cancelled = nullptr
+);
+
+/*
+Runs apply_all on a background thread for the GUI.
+*/
+class Batch : public QObject {
+    Q_OBJECT
+
+   public:
+    explicit Batch(QObject* parent = nullptr);
+    ~Batch() override;
+
+    void start(const QStringList& files, Operation operation);
+    void cancel();
+    bool is_running() const;
+
+   signals:
+    void progress(int done, int total);
+    void finished(const QStringList& files, int failed);
+
+   private:
+    QThread* worker = nullptr;
+    std::atomic<bool> cancelled{false};
+};
+
+}  // namespace Transform
@@ -0,0 +1,616 @@
+#include "library.h"
+
+#include <numbers>
+
+#include "loader.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "utils.h"
+
+namespace Library {
+
+Record read_record(const QString& path) {
+    Record record;
+    record.path = path;
+
+    QFileInfo info(path);
+    record.size = info.size();
+    record.modified = info.lastModified().toMSecsSinceEpoch();
+
+    try {
+        auto image = Exiv2::ImageFactory::open(path.toStdString());
+        image->readMetadata();
+        Exiv2::ExifData& exif_data = image->exifData();
+
+        auto value = [&](const char* key) -> std::string {
+            auto it = exif_data.findKey(Exiv2::ExifKey(key));
+            return it == exif_data.end() ? "" : it->value().toString();
+        };
+
+        record.camera = QString::fromStdString(
+            value("Exif.Image.Make") + " " + value("Exif.Image.Model")
+        ).trimmed();
+
+        QDateTime taken = QDateTime::fromString(
+            QString::fromStdString(value("Exif.Photo.DateTimeOriginal")),
+            "yyyy:MM:dd HH:mm:ss"
+        );
+        if (taken.isValid()) record.taken = taken.toMSecsSinceEpoch();
+
+        std::string focal_length = value("Exif.Photo.FocalLength");
+        if (focal_length.find('/') != std::string::npos) {
+            record.focal_length = Utils::parse_rational(focal_length);
+        }
+        else if (!focal_length.empty()) {
+            record.focal_length = std::stod(focal_length);
+        }
+
+        std::string iso = value("Exif.Photo.ISOSpeedRatings");
+        if (!iso.empty()) record.iso = std::stoi(iso);
+
+        std::string latitude = value("Exif.GPSInfo.GPSLatitude");
+        std::string longitude = value("Exif.GPSInfo.GPSLongitude");
+        if (!latitude.empty() && !longitude.empty()) {
+            record.latitude = Utils::to_decimal(
+                QString::fromStdString(latitude).split(' '),
+                value("Exif.GPSInfo.GPSLatitudeRef")
+            );
+            record.longitude = Utils::to_decimal(
+                QString::fromStdString(longitude).split(' '),
+                value("Exif.GPSInfo.GPSLongitudeRef")
+            );
+        }
+    }
+    catch (const std::exception& error) {
+        std::cerr << "Failed to index " << path.toStdString() << ": "
+                  << error.what() << "\n";
+    }
+
+    return record;
+}
+
+Bitmap::Bitmap(size_t bits, bool value) {
+    this->words.assign((bits + 63) / 64, value ? ~uint64_t{0} : 0);
+    if (value && bits % 64) {
+        this->words.back() = (uint64_t{1} << (bits % 64)) - 1;
+    }
+}
+
+void Bitmap::set(size_t bit) {
+    this->words[bit / 64] |= uint64_t{1} << (bit % 64);
+}
+
+bool Bitmap::test(size_t bit) const {
+    return (this->words[bit / 64] >> (bit % 64)) & 1;
+}
+
+size_t Bitmap::count() const {
+    size_t count = 0;
+    for (uint64_t word : this->words) count += static_cast<size_t>(std::popcount(word));
+    return count;
+}
+
+Bitmap& Bitmap::operator&=(const Bitmap& other) {
+    for (size_t i = 0; i < this->words.size(); ++i) this->words[i] &= other.words[i];
+    return *this;
+}
+
+Bitmap& Bitmap::operator|=(const Bitmap& other) {
+    for (size_t i = 0; i < this->words.size(); ++i) this->words[i] |= other.words[i];
+    return *this;
+}
+
+std::vector<uint32_t> Bitmap::indices() const {
+    std::vector<uint32_t> indices;
+    indices.reserve(this->count());
+    for (size_t i = 0; i < this->words.size(); ++i) {
+        uint64_t word = this->words[i];
+        while (word) {
+            indices.push_back(static_cast<uint32_t>(i * 64) +
+                              static_cast<uint32_t>(std::countr_zero(word)));
+            word &= word - 1;
+        }
+    }
+    return indices;
+}
+
+static std::optional<qint64> parse_date(const QString& text, bool end) {
+    for (const char* format : {"yyyy-MM-dd", "yyyy-MM", "yyyy"}) {
+        QDate date = QDate::fromString(text, format);
+        if (!date.isValid()) continue;
+
+        if (end) {
+            QString f(format);
+            if (f == "yyyy") date = date.addYears(1);
+            else if (f == "yyyy-MM") date = date.addMonths(1);
+            else date = date.addDays(1);
+            return date.startOfDay().toMSecsSinceEpoch() - 1;
+        }
+        return date.startOfDay().toMSecsSinceEpoch();
+    }
+    return std::nullopt;
+}
+
+template <typename T>
+static std::optional<std::pair<T, T>> parse_range(
+    const QString& text,
+    const QString& separator
+) {
+    auto parse = [](const QString& part, T fallback) -> std::optional<T> {
+        if (part.isEmpty()) return fallback;
+        bool ok;
+        double value = part.toDouble(&ok);
+        if (!ok) return std::nullopt;
+        return static_cast<T>(value);
+    };
+
+    int split = static_cast<int>(text.indexOf(separator));
+    QString low = split < 0 ? text : text.left(split);
+    QString high = split < 0 ? text : text.mid(split + separator.size());
+
+    auto minimum = parse(low, std::numeric_limits<T>::lowest());
+    auto maximum = parse(high, std::numeric_limits<T>::max());
+    if (!minimum || !maximum) return std::nullopt;
+    return std::make_pair(*minimum, *maximum);
+}
+
+static std::vector<double> parse_numbers(const QString& text) {
+    std::vector<double> numbers;
+    for (const QString& part : text.split(',')) {
+        bool ok;
+        double number = part.toDouble(&ok);
+        if (!ok) return {};
+        numbers.push_back(number);
+    }
+    return numbers;
+}
+
+Query Query::parse(const QString& text) {
+    Query query;
+
+    for (const QString& term : text.split(' ', Qt::SkipEmptyParts)) {
+        int colon = static_cast<int>(term.indexOf(':'));
+        QString key = colon < 0 ? "" : term.left(colon).toLower();
+        QString value = term.mid(colon + 1);
+
+        if (key == "camera") {
+            query.camera = value;
+        }
+        else if (key == "iso") {
+            query.iso = parse_range<int>(value, "-");
+        }
+        else if (key == "focal") {
+            query.focal_length = parse_range<double>(value, "-");
+        }
+        else if (key == "date") {
+            int split = static_cast<int>(value.indexOf(".."));
+            QString low = split < 0 ? value : value.left(split);
+            QString high = split < 0 ? value : value.mid(split + 2);
+            query.taken = std::make_pair(
+                parse_date(low, false).value_or(std::numeric_limits<qint64>::lowest()),
+                parse_date(high, true).value_or(std::numeric_limits<qint64>::max())
+            );
+        }
+        else if (key == "box") {
+            std::vector<double> numbers = parse_numbers(value);
+            if (numbers.size() == 4) {
+                query.box = Box{
+                    std::min(numbers[0], numbers[2]),
+                    numbers[1],
+                    std::max(numbers[0], numbers[2]),
+                    numbers[3]
+                };
+            }
+        }
+        else if (key == "near") {
+            std::vector<double> numbers = parse_numbers(value);
+            if (numbers.size() == 3) {
+                query.near = Circle{numbers[0], numbers[1], numbers[2]};
+            }
+        }
+        else {
+            // Bare words match the camera, which is the most common filter
+            query.camera = term;
+        }
+    }
+
+    return query;
+}
+
+bool Query::empty() const {
+    return this->camera.isEmpty() && !this->taken && !this->focal_length &&
+           !this->iso && !this->box && !this->near;
+}
+
+double haversine(
+    double latitude_1,
+    double longitude_1,
+    double latitude_2,
+    double longitude_2
+) {
+    const double radius = 6371.0;
+    const double to_radians = std::numbers::pi / 180.0;
+
+    double d_latitude = (latitude_2 - latitude_1) * to_radians;
+    double d_longitude = (longitude_2 - longitude_1) * to_radians;
+    double a = std::sin(d_latitude / 2) * std::sin(d_latitude / 2) +
+               std::cos(latitude_1 * to_radians) * std::cos(latitude_2 * to_radians) *
+               std::sin(d_longitude / 2) * std::sin(d_longitude / 2);
+    return 2 * radius * std::asin(std::sqrt(a));
+}
+
+int64_t Index::cell(int latitude, int longitude) {
+    return (static_cast<int64_t>(latitude) + 1000) * 4096 + (longitude + 1000);
+}
+
+void Index::build(std::vector<Record> records) {
+    TRACE_SCOPE("library_index");
+
+    this->records = std::move(records);
+    size_t count = this->records.size();
+
+    this->cameras.clear();
+    this->by_taken.clear();
+    this->by_focal_length.clear();
+    this->by_iso.clear();
+    this->grid.clear();
+
+    for (size_t i = 0; i < count; ++i) {
+        const Record& record = this->records[i];
+        auto id = static_cast<uint32_t>(i);
+
+        if (!record.camera.isEmpty()) {
+            auto [it, inserted] = this->cameras.try_emplace(record.camera, count);
+            it->second.set(i);
+        }
+        if (record.taken) this->by_taken.emplace_back(*record.taken, id);
+        if (!std::isnan(record.focal_length)) {
+            this->by_focal_length.emplace_back(record.focal_length, id);
+        }
+        if (record.iso >= 0) this->by_iso.emplace_back(record.iso, id);
+        if (record.has_location()) {
+            this->grid[cell(
+                static_cast<int>(std::floor(record.latitude / CELL_DEGREES)),
+                static_cast<int>(std::floor(record.longitude / CELL_DEGREES))
+            )].push_back(id);
+        }
+    }
+
+    std::sort(this->by_taken.begin(), this->by_taken.end());
+    std::sort(this->by_focal_length.begin(), this->by_focal_length.end());
+    std::sort(this->by_iso.begin(), this->by_iso.end());
+}
+
+Bitmap Index::locate(const Box& box) const {
+    Bitmap bits(this->records.size());
+
+    auto scan = [&](double min_longitude, double max_longitude) {
+        int first_latitude = static_cast<int>(std::floor(std::max(box.min_latitude, -90.0) / CELL_DEGREES));
+        int last_latitude = static_cast<int>(std::floor(std::min(box.max_latitude, 90.0) / CELL_DEGREES));
+        int first_longitude = static_cast<int>(std::floor(min_longitude / CELL_DEGREES));
+        int last_longitude = static_cast<int>(std::floor(max_longitude / CELL_DEGREES));
+
+        for (int latitude = first_latitude; latitude <= last_latitude; ++latitude) {
+            for (int longitude = first_longitude; longitude <= last_longitude; ++longitude) {
+                auto it = this->grid.find(cell(latitude, longitude));
+                if (it == this->grid.end()) continue;
+
+                for (uint32_t id : it->second) {
+                    const Record& record = this->records[id];
+                    if (record.latitude >= box.min_latitude &&
+                        record.latitude <= box.max_latitude &&
+                        record.longitude >= min_longitude &&
+                        record.longitude <= max_longitude) {
+                        bits.set(id);
+                    }
+                }
+            }
+        }
+    };
+
+    // A box crossing the antimeridian is two boxes
+    if (box.min_longitude <= box.max_longitude) {
+        scan(box.min_longitude, box.max_longitude);
+    }
+    else {
+        scan(box.min_longitude, 180.0);
+        scan(-180.0, box.max_longitude);
+    }
+    return bits;
+}
+
+std::vector<uint32_t> Index::query(const Query& query) const {
+    TRACE_SCOPE("library_query");
+
+    size_t count = this->records.size();
+    Bitmap result(count, true);
+
+    if (!query.camera.isEmpty()) {
+        Bitmap matches(count);
+        for (const auto& [camera, bits] : this->cameras) {
+            if (camera.contains(query.camera, Qt::CaseInsensitive)) matches |= bits;
+        }
+        result &= matches;
+    }
+
+    auto range = [&](const auto& sorted, auto low, auto high) {
+        using Value = decltype(sorted.front().first);
+        auto less = [](const auto& entry, Value value) { return entry.first < value; };
+        auto greater = [](Value value, const auto& entry) { return value < entry.first; };
+
+        Bitmap bits(count);
+        auto first = std::lower_bound(sorted.begin(), sorted.end(), static_cast<Value>(low), less);
+        auto last = std::upper_bound(first, sorted.end(), static_cast<Value>(high), greater);
+        for (auto it = first; it != last; ++it) bits.set(it->second);
+        result &= bits;
+    };
+
+    if (query.taken) range(this->by_taken, query.taken->first, query.taken->second);
+    if (query.focal_length) {
+        range(this->by_focal_length, query.focal_length->first, query.focal_length->second);
+    }
+    if (query.iso) range(this->by_iso, query.iso->first, query.iso->second);
+
+    if (query.box) result &= this->locate(*query.box);
+
+    if (query.near) {
+        const Circle& near = *query.near;
+        double latitude_span = near.kilometers / 111.0;
+        double longitude_span = near.kilometers /
+            (111.0 * std::max(std::cos(near.latitude * std::numbers::pi / 180.0), 0.01));
+
+        // Wrapped rather than clamped, so a circle reaching over the
+        // antimeridian becomes a box crossing it, which locate() splits
+        double west = -180.0;
+        double east = 180.0;
+        if (longitude_span < 180.0) {
+            west = std::remainder(near.longitude - longitude_span, 360.0);
+            east = std::remainder(near.longitude + longitude_span, 360.0);
+        }
+
+        Bitmap candidates = this->locate({
+            near.latitude - latitude_span,
+            west,
+            near.latitude + latitude_span,
+            east
+        });
+
+        Bitmap bits(count);
+        for (uint32_t id : candidates.indices()) {
+            const Record& record = this->records[id];
+            if (haversine(near.latitude, near.longitude,
+                          record.latitude, record.longitude) <= near.kilometers) {
+                bits.set(id);
+            }
+        }
+        result &= bits;
+    }
+
+    return result.indices();
+}
+
+const Record& Index::record(uint32_t id) const {
+    return this->records[id];
+}
+
+size_t Index::size() const {
+    return this->records.size();
+}
+
+Catalog::Catalog(QObject* parent) : QObject(parent) {}
+
+Catalog::~Catalog() {
+    this->cancel();
+}
+
+void Catalog::update(const QStringList& files) {
+    this->cancel();
+    this->cancelled = false;
+
+    // XMP parsing is only thread-safe once initialized
+    Exiv2::XmpParser::initialize();
+
+    this->worker = QThread::create([this, files]() {
+        Trace::set_thread_name("Catalog");
+        this->run(files);
+    });
+    this->worker->start(QThread::LowPriority);
+}
+
+void Catalog::cancel() {
+    if (!this->worker) return;
+
+    this->cancelled = true;
+    this->worker->wait();
+    delete this->worker;
+    this->worker = nullptr;
+}
+
+bool Catalog::is_ready() const {
+    std::lock_guard lock(this->mutex);
+    return this->index != nullptr;
+}
+
+QStringList Catalog::query(const Query& query) const {
+    std::shared_ptr<const Index> index;
+    {
+        std::lock_guard lock(this->mutex);
+        index = this->index;
+    }
+    if (!index) return {};
+
+    QStringList files;
+    for (uint32_t id : index->query(query)) {
+        files.append(index->record(id).path);
+    }
+    return files;
+}
+
+std::vector<Record> Catalog::records() const {
+    std::shared_ptr<const Index> index;
+    {
+        std::lock_guard lock(this->mutex);
+        index = this->index;
+    }
+    if (!index) return {};
+
+    std::vector<Record> records;
+    records.reserve(index->size());
+    for (size_t i = 0; i < index->size(); ++i) {
+        records.push_back(index->record(static_cast<uint32_t>(i)));
+    }
+    return records;
+}
+
+void Catalog::run(const QStringList& files) {
+    TRACE_SCOPE("catalog_update");
+
+    const int total = static_cast<int>(files.size());
+    std::vector<Record> records(static_cast<size_t>(total));
+    std::vector<bool> stale(static_cast<size_t>(total), true);
+
+    for (int i = 0; i < total; ++i) {
+        QFileInfo info(files[i]);
+        records[static_cast<size_t>(i)].path = files[i];
+        records[static_cast<size_t>(i)].size = info.size();
+        records[static_cast<size_t>(i)].modified = info.lastModified().toMSecsSinceEpoch();
+    }
+    {
+        std::lock_guard lock(this->mutex);
+        for (int i = 0; i < total; ++i) {
+            Record& record = records[static_cast<size_t>(i)];
+            auto it = this->cache.find(files[i]);
+            if (it != this->cache.end() &&
+                it->second.size == record.size &&
+                it->second.modified == record.modified) {
+                record = it->second;
+                stale[static_cast<size_t>(i)] = false;
+            }
+        }
+    }
+
+    {
+        const int chunk = 64;
+        std::atomic<int> done{0};
+
+        Scheduler::parallel_for(
+            (total + chunk - 1) / chunk,
+            Scheduler::Priority::BACKGROUND,
+            [&](int index) {
+                int begin = index * chunk;
+                int end = std::min(begin + chunk, total);
+                for (int i = begin; i < end && !this->cancelled; ++i) {
+                    if (stale[static_cast<size_t>(i)]) {
+                        records[static_cast<size_t>(i)] = read_record(files[i]);
+                    }
+                }
+                emit this->progress(done += end - begin, total);
+            }
+        );
+    }
+    if (this->cancelled) return;
+
+    auto index = std::make_shared<Index>();
+    {
+        std::lock_guard lock(this->mutex);
+        for (const Record& record : records) this->cache[record.path] = record;
+    }
+    index->build(std::move(records));
+
+    {
+        std::lock_guard lock(this->mutex);
+        this->index = std::move(index);
+    }
+    emit this->finished();
+}
+
+Scanner::Scanner(QObject* parent) : QObject(parent) {}
+
+Scanner::~Scanner() {
+    this->cancel();
+    // Workers post back to this object, so none may outlive it
+    for (QThread* thread : this->findChildren<QThread*>(Qt::FindDirectChildrenOnly)) {
+        thread->wait();
+    }
+}
+
+void Scanner::scan(const QString& folder, bool stream) {
+    this->cancel();
+    this->token = Scheduler::Token();
+
+    int generation = ++this->generation;
+    Scheduler::Token token = this->token;
+    this->worker = QThread::create([this, folder, stream, generation, token]() {
+        Trace::set_thread_name("Scanner");
+        this->run(folder, stream, generation, token);
+    });
+    this->worker->setParent(this);
+    connect(this->worker, &QThread::finished, this->worker, &QObject::deleteLater);
+    this->worker->start(QThread::LowPriority);
+}
+
+void Scanner::cancel() {
+    if (!this->worker) return;
+
+    // Not waited for: on a slow share the directory listing may not return
+    // for a long time. The worker stops at its next entry, and the generation
+    // check drops anything it still delivers.
+    this->token.cancel();
+    this->worker = nullptr;
+}
+
+bool Scanner::is_running() const {
+    return this->worker && this->worker->isRunning();
+}
+
+void Scanner::run(
+    const QString& folder,
+    bool stream,
+    int generation,
+    const Scheduler::Token& token
+) {
+    TRACE_SCOPE("scan_folder");
+
+    // Batches grow with time rather than count, so slow network shares
+    // still trickle in while local folders arrive in a few large chunks
+    const auto interval = std::chrono::milliseconds(100);
+
+    // Hops to the GUI thread, where the generation can be read safely
+    auto deliver = [this, generation](const QStringList& files, bool done) {
+        QMetaObject::invokeMethod(this, [this, generation, files, done] {
+            if (generation != this->generation) return;
+            if (done) {
+                emit this->finished(files);
+            } else {
+                emit this->found(files);
+            }
+        }, Qt::QueuedConnection);
+    };
+
+    QStringList files;
+    qsizetype delivered = 0;
+    auto last = std::chrono::steady_clock::now();
+
+    QDirIterator iterator(
+        folder,
+        Image::name_filters(),
+        QDir::Files,
+        QDirIterator::Subdirectories
+    );
+    while (iterator.hasNext() && !token.cancelled()) {
+        files.append(iterator.next());
+        if (!stream) continue;
+
+        auto now = std::chrono::steady_clock::now();
+        if (delivered == 0 || now - last >= interval) {
+            deliver(files.mid(delivered), false);
+            delivered = files.size();
+            last = now;
+        }
+    }
+    if (token.cancelled()) return;
+
+    deliver(files, true);
+}
+
+}  // namespace Library
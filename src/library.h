@@ -0,0 +1,178 @@
+#pragma once
+
+#include "pch.h"
+
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <unordered_map>
+
+#include "scheduler.h"
+
+namespace Library {
+
+/*
+The searchable subset of a file's metadata. Missing values are NaN, -1 or
+empty; any capture time is valid, including those before 1970.
+*/
+struct Record {
+    QString path;
+    qint64 size = 0;
+    qint64 modified = 0;
+    QString camera;
+    std::optional<qint64> taken;
+    double focal_length = std::numeric_limits<double>::quiet_NaN();
+    int iso = -1;
+    double latitude = std::numeric_limits<double>::quiet_NaN();
+    double longitude = std::numeric_limits<double>::quiet_NaN();
+
+    bool has_location() const {
+        return !std::isnan(this->latitude) && !std::isnan(this->longitude);
+    }
+};
+
+Record read_record(const QString& path);
+
+class Bitmap {
+    std::vector<uint64_t> words;
+
+   public:
+    Bitmap() = default;
+    explicit Bitmap(size_t bits, bool value = false);
+
+    void set(size_t bit);
+    bool test(size_t bit) const;
+    size_t count() const;
+
+    Bitmap& operator&=(const Bitmap& other);
+    Bitmap& operator|=(const Bitmap& other);
+
+    std::vector<uint32_t> indices() const;
+};
+
+struct Box {
+    double min_latitude;
+    double min_longitude;
+    double max_latitude;
+    double max_longitude;
+};
+
+struct Circle {
+    double latitude;
+    double longitude;
+    double kilometers;
+};
+
+/*
+Parsed from space separated terms, for example
+    camera:canon iso:100-800 focal:24-70 date:2021-01-01..2021-06-30
+    box:47.5,-122.5,47.8,-122.2 near:47.6,-122.3,5
+Range bounds may be left open, as in iso:-400 or date:2022..
+*/
+struct Query {
+    QString camera;
+    std::optional<std::pair<qint64, qint64>> taken;
+    std::optional<std::pair<double, double>> focal_length;
+    std::optional<std::pair<int, int>> iso;
+    std::optional<Box> box;
+    std::optional<Circle> near;
+
+    static Query parse(const QString& text);
+    bool empty() const;
+};
+
+double haversine(double latitude_1, double longitude_1, double latitude_2, double longitude_2);
+
+/*
+Immutable set of records with a bitmap index per camera, sorted indexes on the
+scalar fields and a one degree grid over the GPS coordinates.
+*/
+class Index {
+    static constexpr double CELL_DEGREES = 1.0;
+
+    std::vector<Record> records;
+    std::map<QString, Bitmap> cameras;
+    std::vector<std::pair<qint64, uint32_t>> by_taken;
+    std::vector<std::pair<double, uint32_t>> by_focal_length;
+    std::vector<std::pair<int, uint32_t>> by_iso;
+    std::unordered_map<int64_t, std::vector<uint32_t>> grid;
+
+    static int64_t cell(int latitude, int longitude);
+
+    Bitmap locate(const Box& box) const;
+
+   public:
+    void build(std::vector<Record> records);
+
+    std::vector<uint32_t> query(const Query& query) const;
+
+    const Record& record(uint32_t id) const;
+    size_t size() const;
+};
+
+/*
+Reads records for a file set on a background thread and keeps the index that
+queries run against. Records are cached per path, size and modification time.
+*/
+class Catalog : public QObject {
+    Q_OBJECT
+
+   public:
+    explicit Catalog(QObject* parent = nullptr);
+    ~Catalog() override;
+
+    void update(const QStringList& files);
+    void cancel();
+    bool is_ready() const;
+
+    QStringList query(const Query& query) const;
+    std::vector<Record> records() const;
+
+   signals:
+    void progress(int done, int total);
+    void finished();
+
+   private:
+    mutable std::mutex mutex;
+    std::map<QString, Record> cache;
+    std::shared_ptr<const Index> index;
+
+    QThread* worker = nullptr;
+    std::atomic<bool> cancelled{false};
+
+    void run(const QStringList& files);
+};
+
+/*
+Walks a folder tree on a background thread. While streaming, the first match
+is reported on its own and the rest follow in batches, so callers can show an
+image before a large share has been enumerated. Results of a scan that was
+replaced or cancelled are never delivered.
+*/
+class Scanner : public QObject {
+    Q_OBJECT
+
+   public:
+    explicit Scanner(QObject* parent = nullptr);
+    ~Scanner() override;
+
+    void scan(const QString& folder, bool stream);
+    void cancel();
+    bool is_running() const;
+
+   signals:
+    void found(const QStringList& files);
+    void finished(const QStringList& files);
+
+   private:
+    // The current scan; cancelled ones finish on their own and delete
+    // themselves, and are only waited for on destruction
+    QPointer<QThread> worker;
+    Scheduler::Token token;
+    int generation = 0;
+
+    void run(const QString& folder, bool stream, int generation, const Scheduler::Token& token);
+};
+
+}  // namespace Library
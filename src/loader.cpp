@@ -1,6 +1,11 @@
 #include <QDebug>
 #include "loader.h"
 
+#include "allocations.h"
+#include "color.h"
+#include "exif_writer.h"
+#include "readahead.h"
+
 
 static QProcess exiftool;
 
@@ -27,32 +32,125 @@ void stop_exiftool() {
 
 namespace Image {
 
-QPixmap load_heic(const QString& path) {
-    heif_context* ctx = heif_context_alloc();
+const QStringList RAW_EXTENSIONS = {
+    "cr2", "cr3", "nef", "nrw", "arw", "dng", "orf", "rw2", "raf", "pef", "srw"
+};
 
-    heif_error err = heif_context_read_from_file(
-        ctx,
-        path.toUtf8().constData(),
-        nullptr
-    );
-    if (err.code != heif_error_Ok) {
-        heif_context_free(ctx);
-        throw std::runtime_error(
-            "heif_context_read_from_file failed: " + std::string(err.message) + "!"
-        );
+bool is_raw(const QString& path) {
+    return RAW_EXTENSIONS.contains(QFileInfo(path).suffix().toLower());
+}
+
+QStringList name_filters() {
+    QStringList filters = {"*.jpg", "*.jpeg", "*.heic", "*.png", "*.bmp", "*.gif", "*.webp"};
+    for (const QString& extension : RAW_EXTENSIONS) {
+        // Cameras mostly write upper case names, and the match is case sensitive
+        filters.append("*." + extension);
+        filters.append("*." + extension.toUpper());
     }
+    return filters;
+}
 
-    heif_image_handle* handle = nullptr;
-    err = heif_context_get_primary_image_handle(ctx, &handle);
-    if (err.code != heif_error_Ok) {
-        heif_context_free(ctx);
-        throw std::runtime_error(
-            "heif_context_get_primary_image_handle failed: " + std::string(err.message) + "!"
+QByteArray read_raw_preview(const QString& path, const QSize& minimum) {
+    TRACE_SCOPE("read_raw_preview");
+
+    try {
+        // Parsed in place when the read-ahead already fetched the file
+        QByteArray bytes = ReadAhead::cached(path);
+        auto image = bytes.isEmpty()
+            ? Exiv2::ImageFactory::open(path.toStdString())
+            : Exiv2::ImageFactory::open(
+                  reinterpret_cast<const Exiv2::byte*>(bytes.constData()),
+                  static_cast<size_t>(bytes.size())
+              );
+        image->readMetadata();
+
+        Exiv2::PreviewManager manager(*image);
+        // Sorted by pixel count, smallest first
+        Exiv2::PreviewPropertiesList properties = manager.getPreviewProperties();
+        if (properties.empty()) return QByteArray();
+
+        auto chosen = std::prev(properties.end());
+        if (!minimum.isEmpty()) {
+            auto covering = std::find_if(
+                properties.begin(),
+                properties.end(),
+                [&](const Exiv2::PreviewProperties& preview) {
+                    return static_cast<int>(preview.width_) >= minimum.width() &&
+                        static_cast<int>(preview.height_) >= minimum.height();
+                }
+            );
+            if (covering != properties.end()) chosen = covering;
+        }
+
+        Exiv2::PreviewImage preview = manager.getPreviewImage(*chosen);
+        return QByteArray(
+            reinterpret_cast<const char*>(preview.pData()),
+            static_cast<qsizetype>(preview.size())
         );
     }
+    catch (const std::exception& error) {
+        std::cerr << "Failed to read RAW preview of " << path.toStdString()
+                  << ": " << error.what() << "\n";
+        return QByteArray();
+    }
+}
+
+/*
+Read the bytes to hand to Qt's decoders: the file itself, or the embedded
+preview for RAW files.
+*/
+static QByteArray read_file(const QString& path) {
+    STAGE_SCOPE(Stats::Stage::READ);
+
+    if (is_raw(path)) return read_raw_preview(path);
+    return ReadAhead::read(path);
+}
+
+/*
+The color space a HEIF image is encoded in: its embedded ICC profile, or the
+nclx primaries for the two that phones and cameras write. Invalid otherwise.
+*/
+static QColorSpace heif_color_space(heif_image_handle* handle) {
+    switch (heif_image_handle_get_color_profile_type(handle)) {
+        case heif_color_profile_type_prof:
+        case heif_color_profile_type_rICC: {
+            QByteArray profile(
+                static_cast<qsizetype>(heif_image_handle_get_raw_color_profile_size(handle)),
+                Qt::Uninitialized
+            );
+            heif_error err = heif_image_handle_get_raw_color_profile(handle, profile.data());
+            if (err.code != heif_error_Ok) return QColorSpace();
+            return QColorSpace::fromIccProfile(profile);
+        }
+        case heif_color_profile_type_nclx: {
+            heif_color_profile_nclx* nclx = nullptr;
+            heif_error err = heif_image_handle_get_nclx_color_profile(handle, &nclx);
+            if (err.code != heif_error_Ok) return QColorSpace();
+
+            QColorSpace space;
+            if (nclx->transfer_characteristics == heif_transfer_characteristic_IEC_61966_2_1) {
+                if (nclx->color_primaries == heif_color_primaries_SMPTE_EG_432_1) {
+                    space = QColorSpace(QColorSpace::DisplayP3);
+                }
+                else if (nclx->color_primaries == heif_color_primaries_ITU_R_BT_709_5) {
+                    space = QColorSpace(QColorSpace::SRgb);
+                }
+            }
+            heif_nclx_color_profile_free(nclx);
+            return space;
+        }
+        default:
+            return QColorSpace();
+    }
+}
 
+/*
+Decode a HEIF image handle (primary image or thumbnail) into an RGB888 QImage
+that owns its pixels, tagged with its color space.
+*/
+static QImage decode_heif(heif_image_handle* handle) {
     heif_image* image = nullptr;
-    err = heif_decode_image(
+    heif_error err = heif_decode_image(
         handle,
         &image,
         heif_colorspace_RGB,
@@ -60,8 +158,6 @@ QPixmap load_heic(const QString& path) {
         nullptr
     );
     if (err.code != heif_error_Ok) {
-        heif_image_handle_release(handle);
-        heif_context_free(ctx);
         throw std::runtime_error(
             "heif_decode_image failed: " + std::string(err.message) + "!"
         );
@@ -84,19 +180,81 @@ QPixmap load_heic(const QString& path) {
 
     if (!data || width <= 0 || height <= 0) {
         heif_image_release(image);
-        heif_image_handle_release(handle);
-        heif_context_free(ctx);
         throw std::runtime_error("Invalid HEIC data!");
     }
 
     QImage qimg(data, width, height, stride, QImage::Format_RGB888);
     QImage final_image = qimg.copy();  // Must detach from libheif memory before freeing
+    COUNT_COPY(final_image.sizeInBytes());
+    final_image.setColorSpace(heif_color_space(handle));
 
     heif_image_release(image);
+    return final_image;
+}
+
+QImage read_heic(const QString& path) {
+    TRACE_SCOPE("read_heic");
+
+    QByteArray bytes;
+    {
+        STAGE_SCOPE(Stats::Stage::READ);
+        bytes = ReadAhead::read(path);
+        if (bytes.isEmpty()) {
+            throw std::runtime_error(
+                "Failed to open " + path.toStdString() + "!"
+            );
+        }
+    }
+
+    STAGE_SCOPE(Stats::Stage::DECODE);
+
+    heif_context* ctx = heif_context_alloc();
+
+    heif_error err = heif_context_read_from_memory_without_copy(
+        ctx,
+        bytes.constData(),
+        static_cast<size_t>(bytes.size()),
+        nullptr
+    );
+    if (err.code != heif_error_Ok) {
+        heif_context_free(ctx);
+        throw std::runtime_error(
+            "heif_context_read_from_memory failed: " + std::string(err.message) + "!"
+        );
+    }
+
+    heif_image_handle* handle = nullptr;
+    err = heif_context_get_primary_image_handle(ctx, &handle);
+    if (err.code != heif_error_Ok) {
+        heif_context_free(ctx);
+        throw std::runtime_error(
+            "heif_context_get_primary_image_handle failed: " + std::string(err.message) + "!"
+        );
+    }
+
+    QImage final_image;
+    try {
+        final_image = decode_heif(handle);
+    }
+    catch (...) {
+        heif_image_handle_release(handle);
+        heif_context_free(ctx);
+        throw;
+    }
+
     heif_image_handle_release(handle);
     heif_context_free(ctx);
 
-    QPixmap pixmap = QPixmap::fromImage(final_image);
+    return final_image;
+}
+
+QPixmap load_heic(const QString& path) {
+    TRACE_SCOPE("load_heic");
+
+    QImage image = read_heic(path);
+    // RGB888 is converted on upload
+    COUNT_COPY(image.sizeInBytes());
+    QPixmap pixmap = QPixmap::fromImage(std::move(image));
     if (pixmap.isNull()) {
         throw std::runtime_error("Null HEIC pixmap!");
     }
@@ -104,14 +262,208 @@ QPixmap load_heic(const QString& path) {
     return pixmap;
 }
 
-QPixmap load_image(const QString& path) {
+int read_orientation(const QString& path, const Exiv2::ExifData& exif_data) {
+    if (path.endsWith(".heic", Qt::CaseInsensitive)) return 1;
+
+    auto it = exif_data.findKey(Exiv2::ExifKey("Exif.Image.Orientation"));
+    if (it == exif_data.end()) return 1;
+
+    int orientation = std::atoi(it->value().toString().c_str());
+    return orientation >= 1 && orientation <= 8 ? orientation : 1;
+}
+
+bool swaps_axes(int orientation) {
+    return orientation >= 5;
+}
+
+QTransform orientation_transform(int orientation) {
+    QTransform flip;
+    if (orientation == 2 || orientation == 7) flip = QTransform::fromScale(-1, 1);
+    if (orientation == 4 || orientation == 5) flip = QTransform::fromScale(1, -1);
+
+    qreal angle = 0;
+    switch (orientation) {
+        case 3: angle = 180; break;
+        case 5:
+        case 6:
+        case 7: angle = 90; break;
+        case 8: angle = 270; break;
+        default: break;
+    }
+    // Mirror first, then rotate clockwise
+    return flip * QTransform().rotate(angle);
+}
+
+QPixmap load_image(const QString& path, QColorSpace& color_space) {
+    TRACE_SCOPE("load_image");
+
+    QImage image;
     if (path.endsWith(".heic")) {
-        std::cout << "load";
-        return load_heic(path);
+        image = read_heic(path);
+        // RGB888 is converted on upload
+        COUNT_COPY(image.sizeInBytes());
     }
     else {
-        return QPixmap(path);
+        QByteArray bytes = read_file(path);
+        if (bytes.isEmpty()) return QPixmap();
+
+        STAGE_SCOPE(Stats::Stage::DECODE);
+        image = QImage::fromData(bytes);
+    }
+    // QPixmap does not keep the color space
+    color_space = image.colorSpace();
+    return QPixmap::fromImage(std::move(image));
+}
+
+QImage read_image(const QString& path) {
+    TRACE_SCOPE("read_image");
+
+    if (path.endsWith(".heic", Qt::CaseInsensitive)) return read_heic(path);
+
+    QByteArray bytes = read_file(path);
+    if (bytes.isEmpty()) return QImage();
+
+    STAGE_SCOPE(Stats::Stage::DECODE);
+    return QImage::fromData(bytes);
+}
+
+QImage decode_scaled(const QString& path, const QSize& size, QSize& original) {
+    TRACE_SCOPE("decode_scaled");
+
+    if (path.endsWith(".heic", Qt::CaseInsensitive)) {
+        // libheif cannot decode at reduced size, so the full frame is transient
+        QImage full = read_heic(path);
+        original = full.size();
+        QImage scaled;
+        {
+            STAGE_SCOPE(Stats::Stage::SCALE);
+            scaled = full.scaled(size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        }
+        Color::to_display(scaled);
+        return scaled;
+    }
+
+    QByteArray bytes = read_file(path);
+    if (bytes.isEmpty()) return QImage();
+
+    QImage image;
+    {
+        STAGE_SCOPE(Stats::Stage::DECODE);
+        QBuffer buffer(&bytes);
+        QImageReader reader(&buffer);
+        original = reader.size();
+        if (original.width() > size.width() || original.height() > size.height()) {
+            reader.setScaledSize(original.scaled(size, Qt::KeepAspectRatio));
+        }
+        image = reader.read();
     }
+    Color::to_display(image);
+    return image;
+}
+
+QPixmap load_scaled(const QString& path, const QSize& size, QSize& original) {
+    TRACE_SCOPE("load_scaled");
+    return QPixmap::fromImage(decode_scaled(path, size, original));
+}
+
+QImage load_preview(const QString& path, const QSize& size) {
+    TRACE_SCOPE("load_preview");
+
+    QImage preview;
+    if (path.endsWith(".heic", Qt::CaseInsensitive)) {
+        heif_context* ctx = heif_context_alloc();
+        heif_error err = heif_context_read_from_file(
+            ctx,
+            path.toUtf8().constData(),
+            nullptr
+        );
+        heif_image_handle* handle = nullptr;
+        if (err.code == heif_error_Ok) {
+            err = heif_context_get_primary_image_handle(ctx, &handle);
+        }
+        if (err.code != heif_error_Ok) {
+            heif_context_free(ctx);
+            return QImage();
+        }
+
+        // The embedded thumbnail is far cheaper to decode than the primary image
+        heif_image_handle* thumbnail = nullptr;
+        heif_item_id thumbnail_id;
+        if (heif_image_handle_get_list_of_thumbnail_IDs(handle, &thumbnail_id, 1) == 1) {
+            heif_image_handle_get_thumbnail(handle, thumbnail_id, &thumbnail);
+        }
+
+        try {
+            preview = decode_heif(thumbnail ? thumbnail : handle);
+        }
+        catch (const std::exception& error) {
+            std::cerr << error.what() << "\n";
+        }
+
+        if (thumbnail) heif_image_handle_release(thumbnail);
+        heif_image_handle_release(handle);
+        heif_context_free(ctx);
+    }
+    else if (is_raw(path)) {
+        // RAW files carry several previews; take the smallest that suffices
+        QByteArray bytes = read_raw_preview(path, size);
+        QBuffer buffer(&bytes);
+        QImageReader reader(&buffer);
+        QSize original = reader.size();
+        if (original.width() > size.width() || original.height() > size.height()) {
+            reader.setScaledSize(original.scaled(size, Qt::KeepAspectRatio));
+        }
+        preview = reader.read();
+    }
+    else {
+        // Lets the JPEG plugin use libjpeg's DCT scaling instead of a full decode
+        QImageReader reader(path);
+        QSize original = reader.size();
+        if (original.width() > size.width() || original.height() > size.height()) {
+            reader.setScaledSize(original.scaled(size, Qt::KeepAspectRatio));
+        }
+        preview = reader.read();
+    }
+
+    if (preview.width() > size.width() || preview.height() > size.height()) {
+        preview = preview.scaled(size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+    return preview;
+}
+
+QImage load_thumbnail(const QString& path, const QSize& size) {
+    TRACE_SCOPE("load_thumbnail");
+
+    // libheif already applies HEIC orientation to its thumbnails
+    if (path.endsWith(".heic", Qt::CaseInsensitive)) return load_preview(path, size);
+
+    QImage thumbnail;
+    int orientation = 1;
+    try {
+        auto image = Exiv2::ImageFactory::open(path.toStdString());
+        image->readMetadata();
+        orientation = read_orientation(path, image->exifData());
+
+        // Sorted by pixel count, so the first is the cheapest to decode
+        Exiv2::PreviewManager manager(*image);
+        Exiv2::PreviewPropertiesList properties = manager.getPreviewProperties();
+        if (!properties.empty()) {
+            Exiv2::PreviewImage preview = manager.getPreviewImage(properties.front());
+            thumbnail = QImage::fromData(
+                reinterpret_cast<const uchar*>(preview.pData()),
+                static_cast<int>(preview.size())
+            );
+        }
+    }
+    catch (const std::exception&) {
+        // Files Exiv2 cannot parse still get a scaled decode below
+    }
+
+    if (thumbnail.isNull()) {
+        QSize fit = swaps_axes(orientation) ? size.transposed() : size;
+        thumbnail = load_preview(path, fit);
+    }
+    return thumbnail.transformed(orientation_transform(orientation));
 }
 
 void write_heic(
@@ -171,16 +523,25 @@ std::unique_ptr<Exiv2::Image> write_image(
     const std::map<std::string, std::string>& metadata,
     std::unique_ptr<Exiv2::Image> image
 ) {
+    TRACE_SCOPE("write_image");
+    STAGE_SCOPE(Stats::Stage::WRITE);
+
     if (filepath.endsWith(".heic")) {
         write_heic(filepath.toStdString(), metadata);
     }
     else {
-        Exiv2::ExifData exif_data = image->exifData();
+        Exiv2::ExifData& exif_data = image->exifData();
         for (auto& [key, value] : metadata) {
             exif_data[key] = value;
         }
 
-        image->setExifData(exif_data);
+        // Only the Exif block changes, so JPEGs avoid a full Exiv2 rewrite
+        QString suffix = QFileInfo(filepath).suffix().toLower();
+        if ((suffix == "jpg" || suffix == "jpeg") &&
+            (Exif::patch_jpeg(filepath, exif_data) ||
+             Exif::rewrite_jpeg(filepath, exif_data))) {
+            return image;
+        }
         image->writeMetadata();
     }
     return image;
@@ -1,4 +1,8 @@
+#pragma once
+
 #include "pch.h"
+#include "stats.h"
+#include "trace.h"
 
 void start_exiftool();
 
@@ -6,9 +10,89 @@ void stop_exiftool();
 
 namespace Image {
 
+// Camera RAW formats, shown through their largest embedded JPEG preview
+extern const QStringList RAW_EXTENSIONS;
+
+bool is_raw(const QString& path);
+
+/*
+QDir name filters for every format the viewer can show.
+*/
+QStringList name_filters();
+
+/*
+Extract an embedded JPEG preview from a RAW file with Exiv2's PreviewManager:
+the smallest one that covers minimum, or the largest when none does or
+minimum is empty. Returns the encoded JPEG, empty when the file has none.
+Safe to call from worker threads.
+*/
+QByteArray read_raw_preview(const QString& path, const QSize& minimum = QSize());
+
+/*
+Decode a HEIC file to an image. Unlike load_heic this is safe to call from
+worker threads.
+*/
+QImage read_heic(const QString& path);
+
 QPixmap load_heic(const QString& path);
 
-QPixmap load_image(const QString& path);
+/*
+The EXIF Orientation (1-8) to apply when displaying path, 1 when absent.
+HEIC is always 1: libheif already applies the irot/imir transforms while
+decoding, and HEIF treats the EXIF tag as informative only.
+*/
+int read_orientation(const QString& path, const Exiv2::ExifData& exif_data);
+
+/*
+Orientations 5 to 8 turn the image by 90 degrees.
+*/
+bool swaps_axes(int orientation);
+
+/*
+The transform that puts an image stored with orientation upright. Apply it
+after downscaling so it only ever touches display resolution pixels.
+*/
+QTransform orientation_transform(int orientation);
+
+/*
+Decode at full resolution. color_space receives the color space the pixels
+are in, which the pixmap itself cannot carry; convert with Color::to_display
+once scaled down.
+*/
+QPixmap load_image(const QString& path, QColorSpace& color_space);
+
+/*
+Worker thread safe variant of load_image. Returns a null image on failure.
+*/
+QImage read_image(const QString& path);
+
+/*
+Decode straight to a size that fits within size, so the full resolution frame
+never becomes resident (except transiently for HEIC). original receives the
+full resolution dimensions. The result is already in the display's color
+space.
+*/
+QPixmap load_scaled(const QString& path, const QSize& size, QSize& original);
+
+/*
+Worker thread safe variant of load_scaled.
+*/
+QImage decode_scaled(const QString& path, const QSize& size, QSize& original);
+
+/*
+Decode a small preview that fits within size, using embedded thumbnails or
+scaled decoding where the format allows. Safe to call from worker threads.
+Returns a null image on failure.
+*/
+QImage load_preview(const QString& path, const QSize& size);
+
+/*
+The cheapest picture of a file that is still recognisable, for scrubbing:
+the smallest embedded preview (the Exif thumbnail for most JPEGs) when there
+is one, or load_preview at size otherwise. Orientation is applied. Safe to
+call from worker threads.
+*/
+QImage load_thumbnail(const QString& path, const QSize& size);
 
 void write_heic(
     const std::string& filepath,
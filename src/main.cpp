@@ -3,12 +3,90 @@
 int main(int argc, char* argv[]) {
     QApplication app(argc, argv);
 
-    Application application(argv[1]);
-    application.show();
+    Trace::init();
+    Trace::set_thread_name("GUI");
 
-    int result = app.exec();
+    // Batch mode: application --rotate <auto|90|180|270|flip-h|flip-v> files...
+    if (argc > 2 && std::string(argv[1]) == "--rotate") {
+        auto operation = Transform::parse_operation(argv[2]);
+        if (!operation) {
+            std::cerr << "Unknown rotation " << argv[2] << "\n";
+            return 1;
+        }
+
+        QStringList files;
+        for (int i = 3; i < argc; ++i) files.append(QString::fromLocal8Bit(argv[i]));
+
+        int failed = Transform::apply_all(files, *operation);
+        std::cout << "Transformed " << files.size() - failed << " of "
+                  << files.size() << " images\n";
+        Scheduler::shutdown();
+        ReadAhead::shutdown();
+        Trace::finish();
+        Stats::finish();
+        return failed == 0 ? 0 : 1;
+    }
+
+    // Batch mode: application --export <dir> [--size N] [--format jpg|webp]
+    // [--quality Q] files or folders...
+    if (argc > 2 && std::string(argv[1]) == "--export") {
+        Export::Options options;
+        options.directory = QString::fromLocal8Bit(argv[2]);
+
+        QStringList files;
+        for (int i = 3; i < argc; ++i) {
+            std::string argument = argv[i];
+            if (i + 1 < argc && argument == "--size") {
+                options.size = std::max(1, std::atoi(argv[++i]));
+            } else if (i + 1 < argc && argument == "--format") {
+                options.format = QString(argv[++i]).toLower();
+            } else if (i + 1 < argc && argument == "--quality") {
+                options.quality = std::clamp(std::atoi(argv[++i]), 0, 100);
+            } else if (QFileInfo(QString::fromLocal8Bit(argv[i])).isDir()) {
+                QDirIterator it(
+                    QString::fromLocal8Bit(argv[i]),
+                    Image::name_filters(),
+                    QDir::Files,
+                    QDirIterator::Subdirectories
+                );
+                while (it.hasNext()) files.append(it.next());
+            } else {
+                files.append(QString::fromLocal8Bit(argv[i]));
+            }
+        }
+        if (options.format != "jpg" && options.format != "webp") {
+            std::cerr << "Unknown format " << options.format.toStdString() << "\n";
+            return 1;
+        }
+
+        Export::Result result = Export::run(files, options);
+        std::cout << "Exported " << result.exported << " of " << files.size()
+                  << " images in " << result.seconds << "s ("
+                  << result.images_per_second() << " images/s)\n";
+        Scheduler::shutdown();
+        ReadAhead::shutdown();
+        Trace::finish();
+        Stats::finish();
+        return result.failed == 0 ? 0 : 1;
+    }
+
+    int result;
+    {
+        // Destroyed before the shared pool stops, so its engines cancel their
+        // jobs while the pool can still finish them
+        Application application(argv[1]);
+        application.show();
+
+        Watchdog::start();
+        result = app.exec();
+        Watchdog::stop();
+    }
 
     stop_exiftool();
+    Scheduler::shutdown();
+    ReadAhead::shutdown();
+    Trace::finish();
+    Stats::finish();
     
     return result;
 }
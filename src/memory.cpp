@@ -0,0 +1,261 @@
+#include "memory.h"
+
+#include <fstream>
+
+#include "stats.h"
+#include "utils.h"
+
+namespace Memory {
+
+namespace {
+
+// Pressure (percentage of time stalled over 10s) above which we shrink
+const double PRESSURE_THRESHOLD = 10.0;
+
+qint64 default_budget() {
+    if (const char* budget = std::getenv("PHOTOS_MEMORY_BUDGET")) {
+        qint64 megabytes = std::atoll(budget);
+        if (megabytes > 0) return megabytes * 1024 * 1024;
+    }
+
+    // A quarter of physical memory leaves room on small thin clients
+    std::ifstream meminfo("/proc/meminfo");
+    std::string key;
+    qint64 kilobytes;
+    while (meminfo >> key >> kilobytes) {
+        if (key == "MemTotal:") return kilobytes * 1024 / 4;
+        meminfo.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+    return qint64{1024} * 1024 * 1024;
+}
+
+}  // namespace
+
+qint64 Usage::total() const {
+    qint64 total = 0;
+    for (qint64 bytes : this->bytes) total += bytes;
+    return total;
+}
+
+Accountant::Accountant() : limit(default_budget()) {}
+
+Accountant& Accountant::instance() {
+    static Accountant accountant;
+    return accountant;
+}
+
+void Accountant::register_cache(Cache* cache) {
+    std::lock_guard lock(this->mutex);
+    this->caches[cache].name = cache->name();
+}
+
+void Accountant::unregister_cache(Cache* cache) {
+    std::lock_guard lock(this->mutex);
+    this->caches.erase(cache);
+}
+
+void Accountant::add(Cache* cache, Priority priority, qint64 bytes) {
+    std::lock_guard lock(this->mutex);
+    this->caches[cache].bytes[static_cast<size_t>(priority)] += bytes;
+}
+
+void Accountant::remove(Cache* cache, Priority priority, qint64 bytes) {
+    std::lock_guard lock(this->mutex);
+    this->caches[cache].bytes[static_cast<size_t>(priority)] -= bytes;
+}
+
+void Accountant::set_budget(qint64 bytes) {
+    {
+        std::lock_guard lock(this->mutex);
+        this->limit = bytes;
+    }
+    this->enforce();
+}
+
+qint64 Accountant::budget() const {
+    std::lock_guard lock(this->mutex);
+    return this->under_pressure ? this->limit / 2 : this->limit;
+}
+
+qint64 Accountant::usage() const {
+    std::lock_guard lock(this->mutex);
+    qint64 total = 0;
+    for (const auto& [cache, usage] : this->caches) total += usage.total();
+    return total;
+}
+
+std::vector<Usage> Accountant::usage_by_cache() const {
+    std::lock_guard lock(this->mutex);
+    std::vector<Usage> usages;
+    for (const auto& [cache, usage] : this->caches) usages.push_back(usage);
+    return usages;
+}
+
+void Accountant::enforce() {
+    qint64 excess = this->usage() - this->budget();
+    if (excess <= 0) return;
+
+    // Caches call back into remove(), so evict without holding the lock
+    std::vector<Cache*> caches;
+    {
+        std::lock_guard lock(this->mutex);
+        for (const auto& [cache, usage] : this->caches) caches.push_back(cache);
+    }
+
+    for (Priority priority : {Priority::BACKGROUND, Priority::ADJACENT}) {
+        for (Cache* cache : caches) {
+            if (excess <= 0) return;
+            excess -= cache->evict(excess, priority);
+        }
+    }
+}
+
+void Accountant::monitor_pressure(int interval) {
+    if (read_pressure() < 0) return;
+
+    QTimer* timer = new QTimer(qApp);
+    QObject::connect(timer, &QTimer::timeout, [this] {
+        this->poll_pressure();
+    });
+    timer->start(interval);
+}
+
+void Accountant::poll_pressure() {
+    bool pressure = read_pressure() > PRESSURE_THRESHOLD;
+    {
+        std::lock_guard lock(this->mutex);
+        if (pressure == this->under_pressure) return;
+        this->under_pressure = pressure;
+    }
+
+    Stats::count(pressure ? "memory_pressure" : "memory_pressure_relieved");
+    if (pressure) this->enforce();
+}
+
+double read_pressure() {
+    std::vector<std::string> paths;
+
+    // cgroup v2 entries look like "0::/user.slice/..."
+    std::ifstream cgroup("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(cgroup, line)) {
+        if (line.rfind("0::", 0) == 0) {
+            paths.push_back("/sys/fs/cgroup" + line.substr(3) + "/memory.pressure");
+        }
+    }
+    paths.push_back("/proc/pressure/memory");
+
+    for (const std::string& path : paths) {
+        std::ifstream stream(path);
+        while (std::getline(stream, line)) {
+            if (line.rfind("some", 0) != 0) continue;
+
+            size_t start = line.find("avg10=");
+            if (start == std::string::npos) break;
+            return std::atof(line.c_str() + start + 6);
+        }
+    }
+    return -1;
+}
+
+PixmapCache::PixmapCache(const QString& name) : cache_name(name) {
+    Accountant::instance().register_cache(this);
+}
+
+PixmapCache::~PixmapCache() {
+    Accountant::instance().unregister_cache(this);
+}
+
+QString PixmapCache::name() const {
+    return this->cache_name;
+}
+
+qint64 PixmapCache::evict(qint64 bytes, Priority priority) {
+    std::vector<std::pair<uint64_t, QString>> candidates;
+    for (const auto& [key, entry] : this->entries) {
+        if (entry.priority == priority) candidates.emplace_back(entry.last_used, key);
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    qint64 freed = 0;
+    for (const auto& [last_used, key] : candidates) {
+        if (freed >= bytes) break;
+        freed += this->entries[key].bytes;
+        this->remove(key);
+    }
+    return freed;
+}
+
+QPixmap PixmapCache::get(const QString& key) {
+    auto it = this->entries.find(key);
+    if (it == this->entries.end()) return QPixmap();
+
+    it->second.last_used = ++this->clock;
+    return it->second.pixmap;
+}
+
+void PixmapCache::insert(
+    const QString& key,
+    const QPixmap& pixmap,
+    Priority priority
+) {
+    this->remove(key);
+
+    qint64 bytes = pixmap_bytes(pixmap);
+    this->entries[key] = {pixmap, priority, bytes, ++this->clock};
+    Accountant::instance().add(this, priority, bytes);
+    Accountant::instance().enforce();
+}
+
+void PixmapCache::remove(const QString& key) {
+    auto it = this->entries.find(key);
+    if (it == this->entries.end()) return;
+
+    Accountant::instance().remove(this, it->second.priority, it->second.bytes);
+    // Before the erase, since key may refer to the entry's own key
+    if (this->removed) this->removed(key);
+    this->entries.erase(it);
+}
+
+void PixmapCache::clear() {
+    while (!this->entries.empty()) this->remove(this->entries.begin()->first);
+}
+
+void PixmapCache::retag(const std::function<Priority(const QString&)>& priority) {
+    for (auto& [key, entry] : this->entries) {
+        Priority updated = priority(key);
+        if (updated == entry.priority) continue;
+
+        Accountant::instance().remove(this, entry.priority, entry.bytes);
+        Accountant::instance().add(this, updated, entry.bytes);
+        entry.priority = updated;
+    }
+    Accountant::instance().enforce();
+}
+
+void PixmapCache::on_remove(std::function<void(const QString&)> callback) {
+    this->removed = std::move(callback);
+}
+
+qint64 pixmap_bytes(const QPixmap& pixmap) {
+    return qint64{pixmap.width()} * pixmap.height() * pixmap.depth() / 8;
+}
+
+QString summary() {
+    Accountant& accountant = Accountant::instance();
+
+    QString text = QString("memory %1 / %2\n")
+        .arg(Utils::format_size(accountant.usage()))
+        .arg(Utils::format_size(accountant.budget()));
+
+    for (const Usage& usage : accountant.usage_by_cache()) {
+        text += QString("  %1 %2 (%3 visible, %4 adjacent)\n")
+            .arg(usage.name, -9)
+            .arg(Utils::format_size(usage.total()))
+            .arg(Utils::format_size(usage.bytes[static_cast<size_t>(Priority::VISIBLE)]))
+            .arg(Utils::format_size(usage.bytes[static_cast<size_t>(Priority::ADJACENT)]));
+    }
+    return text.trimmed();
+}
+
+}  // namespace Memory
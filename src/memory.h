@@ -0,0 +1,132 @@
+#pragma once
+
+#include "pch.h"
+
+#include <array>
+#include <functional>
+#include <mutex>
+
+namespace Memory {
+
+// Lower values are evicted last
+enum class Priority {
+    VISIBLE,
+    ADJACENT,
+    BACKGROUND,
+    COUNT
+};
+
+/*
+Anything holding pixel buffers. Caches report every buffer they hold to the
+accountant and give memory back when asked.
+*/
+class Cache {
+   public:
+    virtual ~Cache() = default;
+
+    virtual QString name() const = 0;
+
+    /*
+    Drop entries of exactly this priority, least recently used first, until at
+    least bytes have been freed. Returns the number of bytes freed.
+    */
+    virtual qint64 evict(qint64 bytes, Priority priority) = 0;
+};
+
+struct Usage {
+    QString name;
+    std::array<qint64, static_cast<size_t>(Priority::COUNT)> bytes{};
+
+    qint64 total() const;
+};
+
+/*
+Process-wide memory budget shared by every cache. When the total exceeds the
+budget, background entries are evicted across all caches, then adjacent ones.
+Visible entries are never evicted. The budget is halved while the kernel
+reports memory pressure for our cgroup.
+*/
+class Accountant {
+    mutable std::mutex mutex;
+    std::map<Cache*, Usage> caches;
+    qint64 limit;
+    bool under_pressure = false;
+
+    Accountant();
+
+   public:
+    static Accountant& instance();
+
+    void register_cache(Cache* cache);
+    void unregister_cache(Cache* cache);
+
+    void add(Cache* cache, Priority priority, qint64 bytes);
+    void remove(Cache* cache, Priority priority, qint64 bytes);
+
+    void set_budget(qint64 bytes);
+    qint64 budget() const;
+    qint64 usage() const;
+    std::vector<Usage> usage_by_cache() const;
+
+    /*
+    Evict until usage fits the effective budget.
+    */
+    void enforce();
+
+    /*
+    Start polling PSI (cgroup memory.pressure, or /proc/pressure/memory).
+    */
+    void monitor_pressure(int interval = 2000);
+    void poll_pressure();
+};
+
+/*
+Reads "some avg10" from a PSI file, or -1 when PSI is unavailable.
+*/
+double read_pressure();
+
+/*
+LRU cache of pixmaps, keyed by string. Only used from the GUI thread.
+*/
+class PixmapCache : public Cache {
+    struct Entry {
+        QPixmap pixmap;
+        Priority priority;
+        qint64 bytes;
+        uint64_t last_used;
+    };
+
+    QString cache_name;
+    std::map<QString, Entry> entries;
+    uint64_t clock = 0;
+    std::function<void(const QString&)> removed;
+
+   public:
+    explicit PixmapCache(const QString& name);
+    ~PixmapCache() override;
+
+    QString name() const override;
+    qint64 evict(qint64 bytes, Priority priority) override;
+
+    QPixmap get(const QString& key);
+    void insert(const QString& key, const QPixmap& pixmap, Priority priority);
+    void remove(const QString& key);
+    void clear();
+
+    /*
+    Reassign every entry's priority, for example after navigation.
+    */
+    void retag(const std::function<Priority(const QString&)>& priority);
+
+    /*
+    Called with the key of every entry that leaves the cache, evicted or not,
+    so data kept alongside it can go too.
+    */
+    void on_remove(std::function<void(const QString&)> callback);
+};
+
+qint64 pixmap_bytes(const QPixmap& pixmap);
+
+QString summary();
+
+}  // namespace Memory
@@ -2,39 +2,62 @@
 
 #include <Exiv2/exiv2.hpp>
 #include <QApplication>
+#include <QBuffer>
+#include <QColorSpace>
+#include <QColorTransform>
+#include <QComboBox>
 #include <QDateTime>
 #include <QDateTimeEdit>
 #include <QFileDialog>
 #include <QFont>
+#include <QImageReader>
+#include <QImageWriter>
 #include <QLabel>
 #include <QLayout>
 #include <QLineEdit>
+#include <QHash>
 #include <QList>
 #include <QMainWindow>
 #include <QNetworkDiskCache>
 #include <QKeyEvent>
 #include <QMap>
 #include <QPair>
+#include <QPainter>
+#include <QPainterPath>
 #include <QPalette>
 #include <QPixmap>
+#include <QPointer>
 #include <QPushButton>
+#include <QSaveFile>
+#include <QScreen>
 #include <QScrollArea>
 #include <QSizePolicy>
 #include <QSpacerItem>
+#include <QStatusBar>
 #include <QString>
 #include <QTextEdit>
 #include <QWidget>
 #include <QTimer>
+#include <QTransform>
+#include <QThread>
+#include <QThreadPool>
 #include <QProcess>
 #include <QtSvgWidgets/QSvgWidget>
+#include "QGeoView/QGVDrawItem.h"
 #include "QGeoView/QGVLayerOSM.h"
 #include <QStackedLayout>
 #include <QDir>
 #include <QDirIterator>
+#include <QFile>
 #include <QGraphicsOpacityEffect>
 #include <QPropertyAnimation>
+#include <QVariantAnimation>
+#include <bit>
+#include <cstring>
 #include <iostream>
 #include <map>
+#include <numeric>
+#include <optional>
 #include <sstream>
 #include <cctype>
 #include <chrono>
@@ -0,0 +1,338 @@
+#include "readahead.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "memory.h"
+#include "stats.h"
+#include "trace.h"
+
+namespace ReadAhead {
+
+namespace {
+
+// Two reads in flight keep a network mount busy without starving the
+// decoder's own misses
+const int IO_THREADS = 2;
+
+const qint64 CHUNK = 8 * 1024 * 1024;
+
+qint64 default_limit() {
+    qint64 megabytes = 256;
+    if (const char* limit = std::getenv("PHOTOS_READAHEAD_MB")) {
+        megabytes = std::max<qint64>(0, std::atoll(limit));
+    }
+    return megabytes * 1024 * 1024;
+}
+
+struct Stamp {
+    qint64 size;
+    qint64 modified;
+
+    bool operator==(const Stamp& other) const = default;
+};
+
+Stamp stamp(const QString& path) {
+    QFileInfo info(path);
+    return {info.size(), info.lastModified().toMSecsSinceEpoch()};
+}
+
+/*
+Thread safe, unlike the pixmap caches. It reports to the accountant but
+never calls enforce(), since that would reach the GUI thread's caches from
+the I/O threads; the next pixmap insert enforces the budget.
+*/
+class Cache : public Memory::Cache {
+   public:
+    Cache() : limit(default_limit()) {
+        Memory::Accountant::instance().register_cache(this);
+        if (this->limit <= 0) return;
+
+        for (int i = 0; i < IO_THREADS; ++i) {
+            this->threads.emplace_back([this, i] { this->work(i); });
+        }
+    }
+
+    ~Cache() override {
+        this->stop();
+        Memory::Accountant::instance().unregister_cache(this);
+    }
+
+    QString name() const override {
+        return "readahead";
+    }
+
+    qint64 evict(qint64 bytes, Memory::Priority priority) override {
+        std::lock_guard lock(this->mutex);
+
+        std::vector<std::pair<uint64_t, QString>> candidates;
+        for (const auto& [path, entry] : this->entries) {
+            if (entry.priority == priority) candidates.emplace_back(entry.last_used, path);
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        qint64 freed = 0;
+        for (const auto& [last_used, path] : candidates) {
+            if (freed >= bytes) break;
+            auto it = this->entries.find(path);
+            freed += it->second.bytes.size();
+            this->remove(it);
+        }
+        return freed;
+    }
+
+    QByteArray read(const QString& path) {
+        Stamp current = stamp(path);
+        {
+            std::unique_lock lock(this->mutex);
+            if (this->in_flight.contains(path)) {
+                // Part of the file is already on its way; reading it again
+                // would only compete for the same link
+                Stats::count("readahead_waits");
+                this->changed.wait(lock, [this, &path] {
+                    return this->stopping || !this->in_flight.contains(path);
+                });
+            }
+            if (std::optional<QByteArray> bytes = this->take(path, current)) {
+                Stats::count("readahead_hits");
+                return *bytes;
+            }
+        }
+
+        Stats::count("readahead_misses");
+        QByteArray bytes = read_sequential(path);
+        if (!bytes.isEmpty() && this->limit > 0) {
+            // Kept for resizes that decode again and for stepping back
+            std::lock_guard lock(this->mutex);
+            this->insert(path, current, bytes, Memory::Priority::BACKGROUND);
+        }
+        return bytes;
+    }
+
+    QByteArray cached(const QString& path) {
+        Stamp current = stamp(path);
+        std::lock_guard lock(this->mutex);
+        return this->take(path, current).value_or(QByteArray());
+    }
+
+    void prefetch(const QStringList& paths) {
+        if (this->limit <= 0) return;
+
+        {
+            std::lock_guard lock(this->mutex);
+            QSet<QString> wanted(paths.begin(), paths.end());
+            for (auto& [path, entry] : this->entries) {
+                Memory::Priority priority = wanted.contains(path)
+                    ? Memory::Priority::ADJACENT
+                    : Memory::Priority::BACKGROUND;
+                this->retag(entry, priority);
+            }
+
+            // Requests for images navigated past are dropped
+            this->queue.clear();
+            for (const QString& path : paths) {
+                if (this->entries.count(path) || this->in_flight.contains(path)) continue;
+                this->queue.push_back(path);
+            }
+        }
+        this->changed.notify_all();
+    }
+
+    void stop() {
+        {
+            std::lock_guard lock(this->mutex);
+            if (this->stopping) return;
+            this->stopping = true;
+            this->queue.clear();
+        }
+        this->changed.notify_all();
+        for (std::thread& thread : this->threads) thread.join();
+        this->threads.clear();
+    }
+
+   private:
+    struct Entry {
+        QByteArray bytes;
+        // Checked on every hit so files changed on disk are read again
+        Stamp stamp;
+        // ADJACENT while wanted by the read-ahead, BACKGROUND otherwise
+        Memory::Priority priority;
+        uint64_t last_used;
+    };
+
+    std::mutex mutex;
+    // Signalled when the queue grows, a read finishes or on stop
+    std::condition_variable changed;
+    std::map<QString, Entry> entries;
+    // Sum of the entries' sizes
+    qint64 total = 0;
+    qint64 limit;
+    uint64_t clock = 0;
+
+    std::deque<QString> queue;
+    QSet<QString> in_flight;
+    std::vector<std::thread> threads;
+    bool stopping = false;
+
+    void work(int index) {
+        Trace::set_thread_name("Read-ahead " + std::to_string(index));
+
+        while (true) {
+            QString path;
+            {
+                std::unique_lock lock(this->mutex);
+                this->changed.wait(lock, [this] {
+                    return this->stopping || !this->queue.empty();
+                });
+                if (this->stopping) return;
+
+                path = this->queue.front();
+                this->queue.pop_front();
+                this->in_flight.insert(path);
+            }
+
+            Stamp current = stamp(path);
+            QByteArray bytes;
+            // A file that big would push everything else out
+            if (current.size > 0 && current.size <= this->limit / 4) {
+                TRACE_SCOPE("read_ahead");
+                bytes = read_sequential(path);
+            }
+
+            {
+                std::lock_guard lock(this->mutex);
+                this->in_flight.remove(path);
+                if (!bytes.isEmpty()) {
+                    Stats::count("readahead_bytes", static_cast<uint64_t>(bytes.size()));
+                    this->insert(path, current, bytes, Memory::Priority::ADJACENT);
+                }
+            }
+            this->changed.notify_all();
+        }
+    }
+
+    // The following expect mutex to be held
+
+    std::optional<QByteArray> take(const QString& path, const Stamp& current) {
+        auto it = this->entries.find(path);
+        if (it == this->entries.end()) return std::nullopt;
+        if (it->second.stamp != current) {
+            this->remove(it);
+            return std::nullopt;
+        }
+
+        it->second.last_used = ++this->clock;
+        return it->second.bytes;
+    }
+
+    void insert(
+        const QString& path,
+        const Stamp& current,
+        const QByteArray& bytes,
+        Memory::Priority priority
+    ) {
+        auto it = this->entries.find(path);
+        if (it != this->entries.end()) this->remove(it);
+
+        this->entries[path] = {bytes, current, priority, ++this->clock};
+        this->total += bytes.size();
+        Memory::Accountant::instance().add(this, priority, bytes.size());
+
+        // Files nobody is heading for go before those the read-ahead fetched,
+        // least recently used first
+        auto rank = [](const auto& item) {
+            const Entry& entry = item.second;
+            return std::pair(entry.priority != Memory::Priority::BACKGROUND, entry.last_used);
+        };
+        while (this->total > this->limit) {
+            this->remove(std::min_element(
+                this->entries.begin(),
+                this->entries.end(),
+                [&rank](const auto& a, const auto& b) { return rank(a) < rank(b); }
+            ));
+        }
+    }
+
+    void remove(std::map<QString, Entry>::iterator it) {
+        Memory::Accountant::instance().remove(this, it->second.priority, it->second.bytes.size());
+        this->total -= it->second.bytes.size();
+        this->entries.erase(it);
+    }
+
+    void retag(Entry& entry, Memory::Priority priority) {
+        if (entry.priority == priority) return;
+
+        Memory::Accountant::instance().remove(this, entry.priority, entry.bytes.size());
+        Memory::Accountant::instance().add(this, priority, entry.bytes.size());
+        entry.priority = priority;
+    }
+};
+
+Cache& cache() {
+    static Cache instance;
+    return instance;
+}
+
+}  // namespace
+
+QByteArray read(const QString& path) {
+    return cache().read(path);
+}
+
+QByteArray cached(const QString& path) {
+    return cache().cached(path);
+}
+
+void prefetch(const QStringList& paths) {
+    cache().prefetch(paths);
+}
+
+QByteArray read_sequential(const QString& path) {
+    int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return QByteArray();
+
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || info.st_size <= 0) {
+        ::close(fd);
+        return QByteArray();
+    }
+
+    // Widens the kernel's read-ahead window, which on NFS also keeps more
+    // READ requests outstanding
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    QByteArray bytes(static_cast<qsizetype>(info.st_size), Qt::Uninitialized);
+    qsizetype done = 0;
+    while (done < bytes.size()) {
+        ssize_t count = ::read(
+            fd,
+            bytes.data() + done,
+            static_cast<size_t>(std::min<qsizetype>(CHUNK, bytes.size() - done))
+        );
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0) {
+            ::close(fd);
+            return QByteArray();
+        }
+        // Truncated while we were reading
+        if (count == 0) break;
+        done += count;
+    }
+    ::close(fd);
+
+    bytes.truncate(done);
+    return bytes;
+}
+
+void shutdown() {
+    cache().stop();
+}
+
+}  // namespace ReadAhead
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "pch.h"
+
+/*
+Read-ahead tier between the decoders and slow storage. A couple of I/O
+threads pull the raw bytes of the files the viewer is about to show into a
+bounded byte cache with large sequential reads, so on NFS or SMB mounts the
+decoder finds the next image in memory instead of waiting on the network.
+The cache has its own budget (PHOTOS_READAHEAD_MB, 256 by default, 0 turns
+prefetching off) and reports to the memory accountant like the pixmap caches.
+*/
+namespace ReadAhead {
+
+/*
+The whole file, from the cache when it holds a current copy, after waiting
+for a read-ahead already in flight, or read directly otherwise. Empty when
+the file cannot be read. Safe to call from any thread.
+*/
+QByteArray read(const QString& path);
+
+/*
+The cached bytes of path, or an empty array without touching the disk.
+*/
+QByteArray cached(const QString& path);
+
+/*
+Replace the read-ahead queue with paths, most urgent first. Files already
+cached or in flight are skipped.
+*/
+void prefetch(const QStringList& paths);
+
+/*
+Read a file front to back in large chunks, advising the kernel that access
+is sequential so it reads ahead aggressively.
+*/
+QByteArray read_sequential(const QString& path);
+
+/*
+Drop the queue and join the I/O threads, before static destructors run.
+*/
+void shutdown();
+
+}  // namespace ReadAhead
@@ -0,0 +1,311 @@
+#include "scheduler.h"
+
+#include <deque>
+#include <thread>
+
+#include "stats.h"
+#include "trace.h"
+
+namespace Scheduler {
+
+namespace {
+
+struct Task {
+    std::function<void()> run;
+    Token token;
+    Priority priority;
+};
+
+struct Queues {
+    std::mutex mutex;
+    std::array<std::deque<Task>, PRIORITIES> tasks;
+};
+
+bool is_low(Priority priority) {
+    return priority == Priority::THUMBNAIL || priority == Priority::BACKGROUND;
+}
+
+/*
+One deque per worker and priority class, plus a shared queue for tasks
+submitted from outside the pool. A worker takes the most urgent task it can
+find: its own newest first, which keeps nested work cache warm, then the
+oldest submitted from outside, then the oldest of another worker's.
+*/
+class Pool {
+   public:
+    Pool() {
+        // Two at least, so a single core still keeps one worker for VISIBLE work
+        int count = static_cast<int>(std::max(2u, std::thread::hardware_concurrency()));
+        this->low_limit = count - 1;
+
+        for (int i = 0; i < count; ++i) {
+            this->queues.push_back(std::make_unique<Queues>());
+        }
+        for (int i = 0; i < count; ++i) {
+            this->threads.emplace_back([this, i] { this->work(i); });
+        }
+    }
+
+    ~Pool() {
+        this->stop();
+    }
+
+    void push(Task task) {
+        Queues& target = current >= 0 ? *this->queues[static_cast<size_t>(current)] : this->injected;
+        {
+            std::lock_guard lock(target.mutex);
+            target.tasks[static_cast<size_t>(task.priority)].push_back(std::move(task));
+        }
+        this->wake();
+    }
+
+    void stop() {
+        {
+            std::lock_guard lock(this->sleep_mutex);
+            if (this->stopping) return;
+            this->stopping = true;
+        }
+        this->sleeping.notify_all();
+        for (std::thread& thread : this->threads) thread.join();
+        this->threads.clear();
+
+        // Destroying the tasks releases whatever they hold, Group counts included
+        for (auto& queues : this->queues) {
+            for (auto& tasks : queues->tasks) tasks.clear();
+        }
+        for (auto& tasks : this->injected.tasks) tasks.clear();
+    }
+
+    int size() const {
+        return static_cast<int>(this->queues.size());
+    }
+
+    // Claims a low priority slot before taking, so the limit holds exactly
+    bool reserve_low() {
+        int running = this->low_running;
+        do {
+            if (running >= this->low_limit) return false;
+        } while (!this->low_running.compare_exchange_weak(running, running + 1));
+        return true;
+    }
+
+    void release_low() {
+        this->low_running--;
+        // A deferred low priority task may fit now
+        this->wake();
+    }
+
+    // Index of the worker running on this thread, or -1 outside the pool
+    static thread_local int current;
+
+   private:
+    std::vector<std::unique_ptr<Queues>> queues;
+    Queues injected;
+    std::vector<std::thread> threads;
+
+    // THUMBNAIL and BACKGROUND tasks running right now, and how many may
+    int low_limit;
+    std::atomic<int> low_running{0};
+
+    std::mutex sleep_mutex;
+    std::condition_variable sleeping;
+    // Bumped whenever a task may have become runnable
+    uint64_t epoch = 0;
+    bool stopping = false;
+
+    void wake() {
+        {
+            std::lock_guard lock(this->sleep_mutex);
+            this->epoch++;
+        }
+        this->sleeping.notify_one();
+    }
+
+    std::optional<Task> take(Queues& queues, size_t priority, bool newest) {
+        std::lock_guard lock(queues.mutex);
+        std::deque<Task>& tasks = queues.tasks[priority];
+        if (tasks.empty()) return std::nullopt;
+
+        Task task = std::move(newest ? tasks.back() : tasks.front());
+        if (newest) {
+            tasks.pop_back();
+        } else {
+            tasks.pop_front();
+        }
+        return task;
+    }
+
+    std::optional<Task> find(int index) {
+        const int count = this->size();
+        for (size_t priority = 0; priority < PRIORITIES; ++priority) {
+            bool low = is_low(static_cast<Priority>(priority));
+            if (low && !this->reserve_low()) break;
+
+            if (auto task = this->take(*this->queues[static_cast<size_t>(index)], priority, true)) {
+                return task;
+            }
+            if (auto task = this->take(this->injected, priority, false)) return task;
+            for (int offset = 1; offset < count; ++offset) {
+                int victim = (index + offset) % count;
+                if (auto task = this->take(*this->queues[static_cast<size_t>(victim)], priority, false)) {
+                    Stats::count("tasks_stolen");
+                    return task;
+                }
+            }
+
+            if (low) this->low_running--;
+        }
+        return std::nullopt;
+    }
+
+    void work(int index) {
+        current = index;
+        Trace::set_thread_name("Worker " + std::to_string(index));
+
+        while (true) {
+            uint64_t seen;
+            {
+                std::lock_guard lock(this->sleep_mutex);
+                if (this->stopping) return;
+                seen = this->epoch;
+            }
+
+            if (std::optional<Task> task = this->find(index)) {
+                this->run(*task);
+                continue;
+            }
+
+            std::unique_lock lock(this->sleep_mutex);
+            this->sleeping.wait(lock, [this, seen] {
+                return this->stopping || this->epoch != seen;
+            });
+        }
+    }
+
+    // Low priority tasks arrive here with their slot already reserved
+    void run(Task& task) {
+        if (task.token.cancelled()) {
+            Stats::count("tasks_cancelled");
+        }
+        else {
+            task.run();
+            Stats::count("tasks_run");
+        }
+
+        if (is_low(task.priority)) this->release_low();
+    }
+};
+
+thread_local int Pool::current = -1;
+
+Pool& pool() {
+    static Pool instance;
+    return instance;
+}
+
+}  // namespace
+
+Token::Token() : flag(std::make_shared<std::atomic<bool>>(false)) {}
+
+void Token::cancel() const {
+    *this->flag = true;
+}
+
+bool Token::cancelled() const {
+    return *this->flag;
+}
+
+void submit(Priority priority, std::function<void()> task, const Token& token) {
+    pool().push({std::move(task), token, priority});
+}
+
+void parallel_for(
+    int count,
+    Priority priority,
+    const std::function<void(int)>& body,
+    const Token& token
+) {
+    if (count <= 0) return;
+
+    struct State {
+        std::atomic<int> next{0};
+        int done = 0;
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    auto state = std::make_shared<State>();
+
+    // Helpers that start after the last iteration was claimed touch only
+    // state, so body can stay a reference to the caller's function
+    auto drain = [state, count, &body, token] {
+        int ran = 0;
+        for (int i = state->next++; i < count; i = state->next++) {
+            if (!token.cancelled()) body(i);
+            ran++;
+        }
+        if (ran == 0) return;
+
+        std::lock_guard lock(state->mutex);
+        state->done += ran;
+        if (state->done == count) state->finished.notify_all();
+    };
+
+    // Inside the pool the caller always drains as well, which keeps nested
+    // calls from deadlocking it. A low priority caller outside the pool
+    // counts against the same limit as the workers, so indexing never takes
+    // the last core, and without a slot leaves the loop to the helpers.
+    bool inside = Pool::current >= 0;
+    bool reserved = !inside && is_low(priority) && pool().reserve_low();
+    bool drains = inside || !is_low(priority) || reserved;
+
+    int helpers = std::min(count, pool().size()) - (drains ? 1 : 0);
+    for (int i = 0; i < helpers; ++i) submit(priority, drain);
+    if (drains) drain();
+    if (reserved) pool().release_low();
+
+    std::unique_lock lock(state->mutex);
+    state->finished.wait(lock, [&] { return state->done == count; });
+}
+
+Group::~Group() {
+    this->cancel();
+    this->wait();
+}
+
+void Group::submit(Priority priority, std::function<void()> task, const Token& token) {
+    {
+        std::lock_guard lock(this->state->mutex);
+        this->state->pending++;
+    }
+
+    // Released with the task, whether it ran, was skipped or was dropped
+    // at shutdown
+    std::shared_ptr<void> done(nullptr, [state = this->state](void*) {
+        std::lock_guard lock(state->mutex);
+        if (--state->pending == 0) state->idle.notify_all();
+    });
+    Scheduler::submit(priority, [done, group = this->token, task = std::move(task)] {
+        if (!group.cancelled()) task();
+    }, token);
+}
+
+void Group::cancel() {
+    this->token.cancel();
+    // Later submissions belong to a fresh generation
+    this->token = Token();
+}
+
+void Group::wait() {
+    std::unique_lock lock(this->state->mutex);
+    this->state->idle.wait(lock, [this] { return this->state->pending == 0; });
+}
+
+int worker_count() {
+    return pool().size();
+}
+
+void shutdown() {
+    pool().stop();
+}
+
+}  // namespace Scheduler
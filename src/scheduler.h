@@ -0,0 +1,110 @@
+#pragma once
+
+#include "pch.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+namespace Scheduler {
+
+/*
+Most urgent first. Only VISIBLE and ADJACENT work may use the last worker,
+so a long THUMBNAIL or BACKGROUND batch can never hold every core while the
+image on screen waits.
+*/
+enum class Priority {
+    // The image on screen and what is drawn around it
+    VISIBLE,
+    // The next and previous images
+    ADJACENT,
+    THUMBNAIL,
+    // Indexing, hashing and batch writes
+    BACKGROUND
+};
+
+const size_t PRIORITIES = 4;
+
+/*
+Shared cancellation flag: copies refer to the same flag. Queued tasks whose
+token is cancelled are dropped without running; running tasks may poll it.
+*/
+class Token {
+   public:
+    Token();
+
+    void cancel() const;
+    bool cancelled() const;
+
+   private:
+    std::shared_ptr<std::atomic<bool>> flag;
+};
+
+/*
+Queue a task on the shared worker pool. Safe to call from any thread,
+including from inside another task.
+*/
+void submit(Priority priority, std::function<void()> task, const Token& token = Token());
+
+/*
+Run body(i) for every i in [0, count) on the pool and block until all have
+finished or been skipped through token. The caller runs iterations itself
+while it waits, so nested calls cannot deadlock the pool. Outside the pool
+a THUMBNAIL or BACKGROUND caller only does so when it gets one of the low
+priority slots, and otherwise leaves the loop to queued helpers, so such
+loops must finish before shutdown().
+*/
+void parallel_for(
+    int count,
+    Priority priority,
+    const std::function<void(int)>& body,
+    const Token& token = Token()
+);
+
+/*
+Run function on context's thread through its event loop, the usual way to
+hand a task's result to the GUI. context has to outlive the call, for
+example by waiting on the Group the task belongs to before it is destroyed.
+*/
+template <typename Function>
+void post(QObject* context, Function&& function) {
+    QMetaObject::invokeMethod(context, std::forward<Function>(function), Qt::QueuedConnection);
+}
+
+/*
+Tasks owned by one object. cancel() drops those still queued, and wait()
+blocks until the running ones return, so an owner can cancel and wait in
+its destructor and let its tasks use this safely. A task is also dropped
+when its own token is cancelled before it starts.
+*/
+class Group {
+   public:
+    Group() = default;
+    ~Group();
+
+    Group(const Group&) = delete;
+    Group& operator=(const Group&) = delete;
+
+    void submit(Priority priority, std::function<void()> task, const Token& token = Token());
+    void cancel();
+    void wait();
+
+   private:
+    struct State {
+        std::mutex mutex;
+        std::condition_variable idle;
+        int pending = 0;
+    };
+
+    std::shared_ptr<State> state = std::make_shared<State>();
+    Token token;
+};
+
+int worker_count();
+
+/*
+Drop all queued tasks and join the workers, before static destructors run.
+*/
+void shutdown();
+
+}  // namespace Scheduler
@@ -0,0 +1,244 @@
+#include "sidecar.h"
+
+#include "loader.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "trace.h"
+#include "utils.h"
+
+namespace Sidecar {
+
+namespace {
+
+const char* TITLE = "Xmp.dc.title";
+const char* DESCRIPTION = "Xmp.dc.description";
+const char* DATE = "Xmp.exif.DateTimeOriginal";
+
+const char* EXIF_DATE_FORMAT = "yyyy:MM:dd HH:mm:ss";
+
+// The panel edits whichever of these tags the image already uses
+const std::vector<std::pair<const char*, const char*>> FIELDS = {
+    {"Exif.Image.XPTitle", TITLE},
+    {"Exif.Image.XPSubject", TITLE},
+    {"Exif.Image.ImageDescription", DESCRIPTION},
+    {"Exif.Image.XPComment", DESCRIPTION},
+    {"Exif.Photo.DateTimeOriginal", DATE}
+};
+
+// The caller says whether XP values are UCS-2 byte strings; a title such as
+// "2024 06" looks like one but is text
+QString text_of(const std::string& key, const std::string& value, bool encoded) {
+    bool binary = encoded && key.rfind("Exif.Image.XP", 0) == 0;
+    return binary ? Utils::from_bytes(value) : QString::fromStdString(value);
+}
+
+std::string lang_alt(const Exiv2::XmpData& xmp, const char* key) {
+    auto it = xmp.findKey(Exiv2::XmpKey(key));
+    if (it == xmp.end()) return "";
+
+    if (auto* value = dynamic_cast<const Exiv2::LangAltValue*>(&it->value())) {
+        return value->toString("x-default");
+    }
+    return it->toString();
+}
+
+void set_lang_alt(Exiv2::XmpData& xmp, const char* key, const QString& text) {
+    Exiv2::LangAltValue value;
+    value.value_["x-default"] = text.toStdString();
+    xmp[key].setValue(&value);
+}
+
+bool load(const QString& path, Exiv2::XmpData& xmp) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    QByteArray packet = file.readAll();
+    if (Exiv2::XmpParser::decode(xmp, packet.toStdString()) != 0) {
+        std::cerr << "Failed to parse sidecar " << path.toStdString() << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool bake_heic(const QString& image, const std::map<std::string, std::string>& fields) {
+    // The shared exiftool process belongs to the GUI thread, so workers run
+    // their own one-shot instance
+    QStringList arguments = {"-overwrite_original"};
+    for (const auto& [key, value] : fields) {
+        QString tag = QString::fromStdString(key).section('.', -1);
+        arguments << "-" + tag + "=" + QString::fromStdString(value);
+    }
+    arguments << image;
+
+    QProcess process;
+    process.start("exiftool", arguments);
+    return process.waitForFinished(-1) &&
+        process.exitStatus() == QProcess::NormalExit &&
+        process.exitCode() == 0;
+}
+
+}  // namespace
+
+QString path_for(const QString& image) {
+    return image + ".xmp";
+}
+
+bool exists(const QString& image) {
+    return QFile::exists(path_for(image));
+}
+
+std::map<std::string, std::string> read(const QString& image) {
+    TRACE_SCOPE("read_sidecar");
+
+    std::map<std::string, std::string> fields;
+    Exiv2::XmpData xmp;
+    if (!exists(image) || !load(path_for(image), xmp)) return fields;
+
+    if (std::string title = lang_alt(xmp, TITLE); !title.empty()) {
+        fields["Exif.Image.XPTitle"] = title;
+    }
+    if (std::string description = lang_alt(xmp, DESCRIPTION); !description.empty()) {
+        fields["Exif.Image.ImageDescription"] = description;
+    }
+
+    auto date = xmp.findKey(Exiv2::XmpKey(DATE));
+    if (date != xmp.end()) {
+        QDateTime time = QDateTime::fromString(
+            QString::fromStdString(date->toString()), Qt::ISODate
+        );
+        if (time.isValid()) {
+            fields["Exif.Photo.DateTimeOriginal"] =
+                time.toString(EXIF_DATE_FORMAT).toStdString();
+        }
+    }
+    return fields;
+}
+
+bool write(
+    const QString& image,
+    const std::map<std::string, std::string>& metadata,
+    bool encoded
+) {
+    TRACE_SCOPE("write_sidecar");
+    STAGE_SCOPE(Stats::Stage::WRITE);
+
+    QString path = path_for(image);
+    Exiv2::XmpData xmp;
+    if (QFile::exists(path)) load(path, xmp);
+
+    for (const auto& [exif_key, xmp_key] : FIELDS) {
+        auto it = metadata.find(exif_key);
+        if (it == metadata.end()) continue;
+
+        QString text = text_of(it->first, it->second, encoded);
+        if (std::strcmp(xmp_key, DATE) == 0) {
+            QDateTime time = QDateTime::fromString(text, EXIF_DATE_FORMAT);
+            if (time.isValid()) {
+                xmp[DATE] = time.toString(Qt::ISODate).toStdString();
+            }
+        }
+        else {
+            set_lang_alt(xmp, xmp_key, text);
+        }
+    }
+
+    std::string packet;
+    if (Exiv2::XmpParser::encode(packet, xmp, Exiv2::XmpParser::useCompactFormat) != 0) {
+        std::cerr << "Failed to encode sidecar for " << image.toStdString() << "\n";
+        return false;
+    }
+
+    // Written to a temporary and renamed, so a crash never leaves half a file
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) return false;
+    file.write(packet.data(), static_cast<qint64>(packet.size()));
+    return file.commit();
+}
+
+bool bake(const QString& image) {
+    TRACE_SCOPE("bake_sidecar");
+    STAGE_SCOPE(Stats::Stage::WRITE);
+
+    if (!exists(image)) return true;
+
+    std::map<std::string, std::string> fields = read(image);
+    if (fields.empty()) return false;
+
+    if (image.endsWith(".heic", Qt::CaseInsensitive)) {
+        if (!bake_heic(image, fields)) return false;
+    }
+    else {
+        try {
+            auto original = Exiv2::ImageFactory::open(image.toStdString());
+            original->readMetadata();
+
+            Exiv2::ExifData& exif_data = original->exifData();
+            for (const auto& [key, value] : fields) {
+                exif_data[key] = key.rfind("Exif.Image.XP", 0) == 0
+                    ? Utils::to_bytes(QString::fromStdString(value))
+                    : value;
+            }
+            Image::write_image(image, {}, std::move(original));
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Failed to bake " << image.toStdString() << ": "
+                      << e.what() << "\n";
+            return false;
+        }
+    }
+    return QFile::remove(path_for(image));
+}
+
+Baker::Baker(QObject* parent) : QObject(parent) {}
+
+Baker::~Baker() {
+    this->cancel();
+}
+
+void Baker::bake(const QStringList& files) {
+    this->cancel();
+    this->cancelled = false;
+
+    // XMP parsing is only thread-safe once initialized
+    Exiv2::XmpParser::initialize();
+    this->worker = QThread::create([this, files]() {
+        Trace::set_thread_name("Baker");
+        this->run(files);
+    });
+    this->worker->start(QThread::LowPriority);
+}
+
+void Baker::cancel() {
+    if (!this->worker) return;
+
+    this->cancelled = true;
+    this->worker->wait();
+    delete this->worker;
+    this->worker = nullptr;
+}
+
+bool Baker::is_running() const {
+    return this->worker && this->worker->isRunning();
+}
+
+void Baker::run(const QStringList& files) {
+    TRACE_SCOPE("bake_sidecars");
+
+    QStringList pending;
+    for (const QString& file : files) {
+        if (exists(file)) pending.append(file);
+    }
+
+    const int total = static_cast<int>(pending.size());
+    std::atomic<int> done{0};
+    std::atomic<int> failed{0};
+    Scheduler::parallel_for(total, Scheduler::Priority::BACKGROUND, [&](int i) {
+        if (this->cancelled) return;
+        if (!Sidecar::bake(pending[i])) failed++;
+        emit this->progress(++done, total);
+    });
+
+    emit this->finished(done - failed, failed);
+}
+
+}  // namespace Sidecar
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "pch.h"
+
+#include <atomic>
+
+namespace Sidecar {
+
+/*
+Sidecars sit next to the image with .xmp appended to the full file name, so
+IMG_0001.jpg and IMG_0001.heic never share one.
+*/
+QString path_for(const QString& image);
+
+bool exists(const QString& image);
+
+/*
+Read a sidecar back as the EXIF keys the panel understands, with plain text
+values. Returns an empty map when there is no sidecar or it fails to parse.
+*/
+std::map<std::string, std::string> read(const QString& image);
+
+/*
+Merge panel edits (EXIF keys) into the image's sidecar. encoded tells whether
+the XP tags hold decimal UCS-2 byte strings, as the panel writes them for
+Exiv2, or plain text, as for HEIC. The sidecar is a few hundred bytes and
+replaced atomically, so the cost does not depend on the size of the original.
+*/
+bool write(
+    const QString& image,
+    const std::map<std::string, std::string>& metadata,
+    bool encoded
+);
+
+/*
+Write a sidecar's fields into the original and remove the sidecar.
+*/
+bool bake(const QString& image);
+
+/*
+Bakes every sidecar in a set of files into the originals on a background
+thread, several files at a time.
+*/
+class Baker : public QObject {
+    Q_OBJECT
+
+   public:
+    explicit Baker(QObject* parent = nullptr);
+    ~Baker() override;
+
+    void bake(const QStringList& files);
+    void cancel();
+    bool is_running() const;
+
+   signals:
+    void progress(int done, int total);
+    void finished(int baked, int failed);
+
+   private:
+    QThread* worker = nullptr;
+    std::atomic<bool> cancelled{false};
+
+    void run(const QStringList& files);
+};
+
+}  // namespace Sidecar
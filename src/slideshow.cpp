@@ -0,0 +1,271 @@
+#include "slideshow.h"
+
+#include "loader.h"
+#include "stats.h"
+#include "trace.h"
+
+namespace Slideshow {
+
+namespace {
+
+// Lateness under one display frame is not visible
+const std::chrono::milliseconds TOLERANCE{16};
+
+QString key(int index) {
+    return QString::number(index);
+}
+
+void draw_centered(QPainter& painter, const QRect& area, const QPixmap& pixmap) {
+    if (pixmap.isNull()) return;
+
+    QSize size = pixmap.size().scaled(area.size(), Qt::KeepAspectRatio);
+    QRect target(QPoint(0, 0), size);
+    target.moveCenter(area.center());
+    painter.drawPixmap(target, pixmap);
+}
+
+}  // namespace
+
+Window::Window(
+    const QStringList& files,
+    int start,
+    int interval,
+    int crossfade,
+    int lookahead
+) : files(files),
+    interval(interval),
+    lookahead(std::min(lookahead, static_cast<int>(files.size()) - 1)),
+    position(start) {
+    this->setAttribute(Qt::WA_DeleteOnClose);
+    this->setAttribute(Qt::WA_OpaquePaintEvent);
+    this->setCursor(Qt::BlankCursor);
+
+    QScreen* screen = QGuiApplication::primaryScreen();
+    this->screen_size = screen->size() * screen->devicePixelRatio();
+
+    this->timer = new QTimer(this);
+    this->timer->setSingleShot(true);
+    this->timer->setTimerType(Qt::PreciseTimer);
+    connect(this->timer, &QTimer::timeout, this, &Window::advance);
+
+    this->fade = new QVariantAnimation(this);
+    this->fade->setStartValue(0.0);
+    this->fade->setEndValue(1.0);
+    this->fade->setDuration(std::max(crossfade, 0));
+    connect(this->fade, &QVariantAnimation::valueChanged, this, [this] {
+        this->update();
+    });
+    connect(this->fade, &QVariantAnimation::finished, this, [this] {
+        this->previous = QPixmap();
+    });
+
+    // XMP parsing is only thread-safe once initialized
+    Exiv2::XmpParser::initialize();
+
+    this->deadline = std::chrono::steady_clock::now();
+    this->prefetch();
+}
+
+Window::~Window() {
+    // Running decodes post back to this window, so they have to finish first
+    this->decodes.cancel();
+    this->decodes.wait();
+}
+
+void Window::paintEvent(QPaintEvent*) {
+    QPainter painter(this);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    painter.fillRect(this->rect(), Qt::black);
+
+    double progress = this->fade->state() == QAbstractAnimation::Running
+        ? this->fade->currentValue().toDouble()
+        : 1.0;
+
+    if (progress < 1.0) {
+        painter.setOpacity(1.0 - progress);
+        draw_centered(painter, this->rect(), this->previous);
+    }
+    painter.setOpacity(progress);
+    draw_centered(painter, this->rect(), this->current);
+}
+
+void Window::keyPressEvent(QKeyEvent* event) {
+    if (event->key() == Qt::Key_Escape) {
+        this->close();
+    }
+    else if (event->key() == Qt::Key_Space) {
+        this->toggle_pause();
+    }
+    else {
+        QWidget::keyPressEvent(event);
+    }
+}
+
+// Null when the slide is not decoded, or was evicted since
+QPixmap Window::slide(int index) {
+    return this->ready.get(key(index));
+}
+
+void Window::decode(int index) {
+    QImage image;
+    try {
+        TRACE_SCOPE("slideshow_decode");
+        const QString& path = this->files[index];
+
+        auto metadata = Exiv2::ImageFactory::open(path.toStdString());
+        metadata->readMetadata();
+        int orientation = Image::read_orientation(path, metadata->exifData());
+
+        QSize original;
+        // Already in the display's color space
+        image = Image::decode_scaled(
+            path,
+            Image::swaps_axes(orientation)
+                ? this->screen_size.transposed()
+                : this->screen_size,
+            original
+        ).transformed(Image::orientation_transform(orientation));
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Slideshow failed to decode "
+                  << this->files[index].toStdString() << ": "
+                  << e.what() << "\n";
+    }
+
+    Scheduler::post(this, [this, index, image] {
+        this->deliver(index, image);
+    });
+}
+
+void Window::deliver(int index, const QImage& image) {
+    TRACE_SCOPE("slideshow_deliver");
+
+    this->requested.erase(index);
+    // Upload now, well ahead of the deadline, so presenting is just a swap.
+    // A failed decode becomes a single black pixel, shown as a black slide.
+    QPixmap pixmap = QPixmap::fromImage(image);
+    if (pixmap.isNull()) {
+        pixmap = QPixmap(1, 1);
+        pixmap.fill(Qt::black);
+    }
+    // The slide being waited for is about to be shown, so it must not be
+    // evicted before present() takes it
+    int next = (this->position + 1) % static_cast<int>(this->files.size());
+    bool shown = index == this->position || (this->waiting && index == next);
+    this->ready.insert(
+        key(index),
+        pixmap,
+        shown ? Memory::Priority::VISIBLE : Memory::Priority::ADJACENT
+    );
+    this->resident.insert(index);
+
+    if (!this->started && index == this->position) {
+        // The first slide has no deadline; the schedule starts when it shows
+        this->started = true;
+        this->current = pixmap;
+        this->deadline = std::chrono::steady_clock::now() + this->interval;
+        this->timer->start(static_cast<int>(this->interval.count()));
+        this->prefetch();
+        this->update();
+    }
+    else if (this->waiting && index == next) {
+        this->waiting = false;
+        this->present(index);
+    }
+}
+
+void Window::advance() {
+    int next = (this->position + 1) % static_cast<int>(this->files.size());
+    if (!this->slide(next).isNull()) {
+        this->present(next);
+    }
+    else {
+        // Keep showing the current slide; deliver() presents it on arrival.
+        // It may have been evicted, in which case this requests it again.
+        this->waiting = true;
+        this->prefetch();
+    }
+}
+
+void Window::present(int index) {
+    TRACE_SCOPE("slideshow_present");
+
+    auto now = std::chrono::steady_clock::now();
+    auto lateness = std::max(
+        std::chrono::duration_cast<std::chrono::microseconds>(now - this->deadline),
+        std::chrono::microseconds(0)
+    );
+    Stats::histogram(Stats::Stage::SLIDE_LATENESS).record(
+        static_cast<uint64_t>(lateness.count())
+    );
+    Stats::count("slideshow_slides");
+    if (lateness > TOLERANCE) Stats::count("slideshow_missed");
+
+    this->previous = this->current;
+    this->current = this->slide(index);
+    this->position = index;
+    this->fade->stop();
+    this->fade->start();
+
+    // After a long miss, restart the schedule rather than rushing through the
+    // slides that are now overdue
+    if (lateness > this->interval) this->deadline = now;
+    this->deadline += this->interval;
+
+    if (!this->paused) {
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+            this->deadline - now
+        );
+        this->timer->start(std::max(0, static_cast<int>(wait.count())));
+    }
+    this->prefetch();
+}
+
+void Window::prefetch() {
+    int count = static_cast<int>(this->files.size());
+    if (count == 0) return;
+
+    // Only the current slide and the lookahead window stay resident
+    auto offset = [this, count](int index) {
+        return (index - this->position + count) % count;
+    };
+    std::erase_if(this->resident, [&](int index) {
+        if (offset(index) <= this->lookahead) return false;
+        this->ready.remove(key(index));
+        return true;
+    });
+    this->ready.retag([&](const QString& name) {
+        return offset(name.toInt()) == 0
+            ? Memory::Priority::VISIBLE
+            : Memory::Priority::ADJACENT;
+    });
+
+    // Submitted in deadline order, and queues of one priority run oldest
+    // first, so the earliest deadline is decoded first
+    for (int k = this->started ? 1 : 0; k <= this->lookahead; ++k) {
+        int index = (this->position + k) % count;
+        if (!this->slide(index).isNull() || this->requested.contains(index)) {
+            continue;
+        }
+
+        this->requested.insert(index);
+        this->decodes.submit(
+            k <= 1 ? Scheduler::Priority::VISIBLE : Scheduler::Priority::ADJACENT,
+            [this, index] { this->decode(index); }
+        );
+    }
+}
+
+void Window::toggle_pause() {
+    this->paused = !this->paused;
+    if (this->paused) {
+        this->timer->stop();
+        this->waiting = false;
+        return;
+    }
+
+    this->deadline = std::chrono::steady_clock::now() + this->interval;
+    this->timer->start(static_cast<int>(this->interval.count()));
+}
+
+}  // namespace Slideshow
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "pch.h"
+
+#include <set>
+
+#include "memory.h"
+#include "scheduler.h"
+
+namespace Slideshow {
+
+/*
+Full screen slideshow over a list of files. Slides follow an absolute
+schedule (each deadline is the previous one plus the interval), and the next
+few slides are decoded at screen size on the shared scheduler, in deadline
+order and with the next slide at VISIBLE priority, so the GUI thread only
+ever swaps in finished pixmaps. A slide that is not ready by its deadline is
+shown as soon as it arrives and counted as missed in the stats.
+*/
+class Window : public QWidget {
+    Q_OBJECT
+
+   public:
+    Window(
+        const QStringList& files,
+        int start,
+        int interval = 5000,
+        int crossfade = 500,
+        int lookahead = 3
+    );
+    ~Window() override;
+
+   protected:
+    void paintEvent(QPaintEvent* event) override;
+    void keyPressEvent(QKeyEvent* event) override;
+
+   private:
+    QStringList files;
+    std::chrono::milliseconds interval;
+    int lookahead;
+    QSize screen_size;
+
+    Scheduler::Group decodes;
+
+    std::set<int> requested;
+    // Decoded slides keyed by index, under the shared memory budget. A slide
+    // evicted before it is shown is simply decoded again.
+    Memory::PixmapCache ready{"slideshow"};
+    // Indices inserted into ready, some of which may have been evicted since
+    std::set<int> resident;
+    int position;
+    bool started = false;
+    bool waiting = false;
+    bool paused = false;
+    std::chrono::steady_clock::time_point deadline;
+
+    QTimer* timer;
+    QVariantAnimation* fade;
+    QPixmap current;
+    QPixmap previous;
+
+    QPixmap slide(int index);
+    void decode(int index);
+    void deliver(int index, const QImage& image);
+    void advance();
+    void present(int index);
+    void prefetch();
+    void toggle_pause();
+};
+
+}  // namespace Slideshow
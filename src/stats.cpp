@@ -0,0 +1,333 @@
+#include "stats.h"
+
+#include "allocations.h"
+#include "watchdog.h"
+
+#include <bit>
+#include <fstream>
+#include <mutex>
+
+namespace Stats {
+
+namespace {
+
+std::array<Histogram, static_cast<size_t>(Stage::COUNT)> histograms;
+
+std::mutex counters_mutex;
+std::map<std::string, uint64_t> counters;
+
+thread_local Stage current = Stage::COUNT;
+thread_local std::atomic<Stage>* shared = nullptr;
+
+void set_current(Stage stage) {
+    current = stage;
+    if (shared) shared->store(stage, std::memory_order_relaxed);
+}
+
+}  // namespace
+
+const char* stage_name(Stage stage) {
+    switch (stage) {
+        case Stage::READ: return "read";
+        case Stage::DECODE: return "decode";
+        case Stage::SCALE: return "scale";
+        case Stage::COLOR: return "color";
+        case Stage::EXIF: return "exif";
+        case Stage::PANEL: return "panel";
+        case Stage::WRITE: return "write";
+        case Stage::NAVIGATE: return "navigate";
+        case Stage::SLIDE_LATENESS: return "slide_late";
+        default: return "unknown";
+    }
+}
+
+int Histogram::bucket(uint64_t value) {
+    if (value < SUB_COUNT) return static_cast<int>(value);
+
+    int msb = static_cast<int>(std::bit_width(value)) - 1;
+    int shift = msb - SUB_BITS;
+    int sub = static_cast<int>((value >> shift) & (SUB_COUNT - 1));
+    return (shift + 1) * SUB_COUNT + sub;
+}
+
+uint64_t Histogram::lower_bound(int bucket) {
+    if (bucket < SUB_COUNT) return static_cast<uint64_t>(bucket);
+
+    int shift = bucket / SUB_COUNT - 1;
+    uint64_t sub = static_cast<uint64_t>(bucket % SUB_COUNT);
+    return (SUB_COUNT + sub) << shift;
+}
+
+uint64_t Histogram::upper_bound(int bucket) {
+    if (bucket < SUB_COUNT) return static_cast<uint64_t>(bucket);
+
+    int shift = bucket / SUB_COUNT - 1;
+    return lower_bound(bucket) + (uint64_t{1} << shift) - 1;
+}
+
+void Histogram::record(uint64_t value) {
+    this->counts[static_cast<size_t>(bucket(value))].fetch_add(
+        1, std::memory_order_relaxed
+    );
+    this->total.fetch_add(1, std::memory_order_relaxed);
+    this->sum.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t current = this->maximum.load(std::memory_order_relaxed);
+    while (value > current &&
+           !this->maximum.compare_exchange_weak(
+               current, value, std::memory_order_relaxed)) {
+    }
+}
+
+void Histogram::reset() {
+    for (auto& count : this->counts) count.store(0, std::memory_order_relaxed);
+    this->total.store(0, std::memory_order_relaxed);
+    this->sum.store(0, std::memory_order_relaxed);
+    this->maximum.store(0, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::count() const {
+    return this->total.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::max() const {
+    return this->maximum.load(std::memory_order_relaxed);
+}
+
+double Histogram::mean() const {
+    uint64_t count = this->count();
+    if (count == 0) return 0.0;
+    return static_cast<double>(this->sum.load(std::memory_order_relaxed)) /
+           static_cast<double>(count);
+}
+
+uint64_t Histogram::percentile(double percentile) const {
+    uint64_t count = this->count();
+    if (count == 0) return 0;
+
+    auto target = static_cast<uint64_t>(
+        std::ceil(percentile / 100.0 * static_cast<double>(count))
+    );
+    target = std::clamp<uint64_t>(target, 1, count);
+
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+        seen += this->counts[static_cast<size_t>(i)].load(
+            std::memory_order_relaxed
+        );
+        if (seen >= target) return std::min(upper_bound(i), this->max());
+    }
+    return this->max();
+}
+
+Histogram& histogram(Stage stage) {
+    return histograms[static_cast<size_t>(stage)];
+}
+
+Timer::Timer(Stage stage) : stage(stage), previous(current) {
+    set_current(stage);
+    this->start = std::chrono::steady_clock::now();
+}
+
+Timer::~Timer() {
+    auto elapsed = std::chrono::steady_clock::now() - this->start;
+    histogram(this->stage).record(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()
+    ));
+    set_current(this->previous);
+}
+
+Stage current_stage() {
+    return current;
+}
+
+void share_stage(std::atomic<Stage>* stage) {
+    shared = stage;
+    if (shared) shared->store(current, std::memory_order_relaxed);
+}
+
+void count(const std::string& name, uint64_t amount) {
+    std::lock_guard lock(counters_mutex);
+    counters[name] += amount;
+}
+
+uint64_t counter(const std::string& name) {
+    std::lock_guard lock(counters_mutex);
+    auto it = counters.find(name);
+    return it == counters.end() ? 0 : it->second;
+}
+
+QString summary() {
+    auto ms = [](uint64_t us) {
+        return QString::number(static_cast<double>(us) / 1000.0, 'f', 1);
+    };
+
+    QString text = QString("%1 %2 %3 %4 %5 %6\n")
+        .arg("stage", -9).arg("n", 6).arg("p50", 8)
+        .arg("p90", 8).arg("p99", 8).arg("max", 8);
+
+    for (size_t i = 0; i < histograms.size(); ++i) {
+        const Histogram& histogram = histograms[i];
+        if (histogram.count() == 0) continue;
+
+        text += QString("%1 %2 %3 %4 %5 %6\n")
+            .arg(stage_name(static_cast<Stage>(i)), -9)
+            .arg(histogram.count(), 6)
+            .arg(ms(histogram.percentile(50)), 8)
+            .arg(ms(histogram.percentile(90)), 8)
+            .arg(ms(histogram.percentile(99)), 8)
+            .arg(ms(histogram.max()), 8);
+    }
+
+    // GUI thread stalls, by the stage they happened in
+    for (size_t i = 0; i <= histograms.size(); ++i) {
+        auto stage = static_cast<Stage>(i);
+        const Histogram& histogram = Watchdog::stalls(stage);
+        if (histogram.count() == 0) continue;
+
+        text += QString("%1 %2 %3 %4 %5 %6\n")
+            .arg("stall " + QString(stage == Stage::COUNT ? "other" : stage_name(stage)), -9)
+            .arg(histogram.count(), 6)
+            .arg(ms(histogram.percentile(50)), 8)
+            .arg(ms(histogram.percentile(90)), 8)
+            .arg(ms(histogram.percentile(99)), 8)
+            .arg(ms(histogram.max()), 8);
+    }
+    text += "(ms)";
+
+#if ENABLE_ALLOCATION_TRACKING
+    auto kb = [](uint64_t bytes) { return QString::number(bytes / 1024); };
+
+    text += QString("\n\n%1 %2 %3 %4 %5")
+        .arg("allocs", -9).arg("n", 9).arg("KB", 9).arg("copies", 7).arg("KB", 9);
+    for (size_t i = 0; i <= histograms.size(); ++i) {
+        auto stage = static_cast<Stage>(i);
+        Allocations::Totals totals = Allocations::totals(stage);
+        if (totals.allocations == 0 && totals.copies == 0) continue;
+
+        text += QString("\n%1 %2 %3 %4 %5")
+            .arg(stage == Stage::COUNT ? "other" : stage_name(stage), -9)
+            .arg(totals.allocations, 9)
+            .arg(kb(totals.bytes), 9)
+            .arg(totals.copies, 7)
+            .arg(kb(totals.copied_bytes), 9);
+    }
+
+    const Allocations::Navigation& navigation = Allocations::navigation();
+    if (navigation.allocations.count() > 0) {
+        text += QString("\nper step p50 %1 allocs %2 KB, p99 %3 allocs %4 KB")
+            .arg(navigation.allocations.percentile(50))
+            .arg(kb(navigation.bytes.percentile(50)))
+            .arg(navigation.allocations.percentile(99))
+            .arg(kb(navigation.bytes.percentile(99)));
+    }
+#endif
+
+    std::lock_guard lock(counters_mutex);
+    for (const auto& [name, value] : counters) {
+        text += QString("\n%1 %2").arg(QString::fromStdString(name), -18).arg(value);
+    }
+    return text;
+}
+
+bool write_json(const std::string& path) {
+    std::ofstream stream(path);
+    if (!stream) {
+        std::cerr << "Failed to open stats file " << path << "\n";
+        return false;
+    }
+
+    stream << "{\"unit\":\"us\",\"stages\":{";
+    bool first = true;
+    for (size_t i = 0; i < histograms.size(); ++i) {
+        const Histogram& histogram = histograms[i];
+        if (!first) stream << ",";
+        first = false;
+
+        stream << "\n\"" << stage_name(static_cast<Stage>(i)) << "\":{"
+               << "\"count\":" << histogram.count()
+               << ",\"mean\":" << histogram.mean()
+               << ",\"p50\":" << histogram.percentile(50)
+               << ",\"p90\":" << histogram.percentile(90)
+               << ",\"p99\":" << histogram.percentile(99)
+               << ",\"p999\":" << histogram.percentile(99.9)
+               << ",\"max\":" << histogram.max() << "}";
+    }
+    stream << "},\"stalls\":{";
+
+    first = true;
+    for (size_t i = 0; i <= histograms.size(); ++i) {
+        auto stage = static_cast<Stage>(i);
+        const Histogram& histogram = Watchdog::stalls(stage);
+        if (!first) stream << ",";
+        first = false;
+
+        stream << "\n\"" << (stage == Stage::COUNT ? "other" : stage_name(stage)) << "\":{"
+               << "\"count\":" << histogram.count()
+               << ",\"p50\":" << histogram.percentile(50)
+               << ",\"p90\":" << histogram.percentile(90)
+               << ",\"p99\":" << histogram.percentile(99)
+               << ",\"max\":" << histogram.max() << "}";
+    }
+    stream << "},\"counters\":{";
+
+    std::lock_guard lock(counters_mutex);
+    first = true;
+    for (const auto& [name, value] : counters) {
+        if (!first) stream << ",";
+        first = false;
+        stream << "\n\"" << name << "\":" << value;
+    }
+    stream << "}";
+
+#if ENABLE_ALLOCATION_TRACKING
+    stream << ",\"allocations\":{\"stages\":{";
+    first = true;
+    for (size_t i = 0; i <= histograms.size(); ++i) {
+        auto stage = static_cast<Stage>(i);
+        Allocations::Totals totals = Allocations::totals(stage);
+        if (!first) stream << ",";
+        first = false;
+
+        stream << "\n\"" << (stage == Stage::COUNT ? "other" : stage_name(stage)) << "\":{"
+               << "\"allocations\":" << totals.allocations
+               << ",\"bytes\":" << totals.bytes
+               << ",\"copies\":" << totals.copies
+               << ",\"copied_bytes\":" << totals.copied_bytes << "}";
+    }
+    stream << "},\"navigation\":{";
+
+    const Allocations::Navigation& navigation = Allocations::navigation();
+    const std::pair<const char*, const Histogram*> series[] = {
+        {"allocations", &navigation.allocations},
+        {"bytes", &navigation.bytes},
+        {"copies", &navigation.copies},
+        {"copied_bytes", &navigation.copied_bytes},
+    };
+    first = true;
+    for (const auto& [name, histogram] : series) {
+        if (!first) stream << ",";
+        first = false;
+
+        stream << "\n\"" << name << "\":{"
+               << "\"count\":" << histogram->count()
+               << ",\"mean\":" << histogram->mean()
+               << ",\"p50\":" << histogram->percentile(50)
+               << ",\"p90\":" << histogram->percentile(90)
+               << ",\"p99\":" << histogram->percentile(99)
+               << ",\"max\":" << histogram->max() << "}";
+    }
+    stream << "}}";
+#endif
+
+    stream << "}\n";
+
+    return static_cast<bool>(stream);
+}
+
+void finish() {
+    const char* path = std::getenv("PHOTOS_STATS");
+    write_json(path && *path ? path : "stats.json");
+}
+
+}  // namespace Stats
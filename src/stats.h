@@ -0,0 +1,108 @@
+#pragma once
+
+#include "pch.h"
+#include "trace.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace Stats {
+
+enum class Stage {
+    READ,
+    DECODE,
+    SCALE,
+    COLOR,
+    EXIF,
+    PANEL,
+    WRITE,
+    NAVIGATE,
+    SLIDE_LATENESS,
+    COUNT
+};
+
+const char* stage_name(Stage stage);
+
+/*
+Log-linear histogram in the style of HdrHistogram: every power of two is split
+into 16 linear sub-buckets, giving ~6% relative precision over the full 64-bit
+range in a fixed ~8KB of 976 64-bit buckets. Recording is lock-free.
+*/
+class Histogram {
+    static constexpr int SUB_BITS = 4;
+    static constexpr int SUB_COUNT = 1 << SUB_BITS;
+    static constexpr int BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+    std::array<std::atomic<uint64_t>, BUCKETS> counts{};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> maximum{0};
+
+    static int bucket(uint64_t value);
+    static uint64_t lower_bound(int bucket);
+    static uint64_t upper_bound(int bucket);
+
+   public:
+    void record(uint64_t value);
+    void reset();
+
+    uint64_t count() const;
+    uint64_t max() const;
+    double mean() const;
+    uint64_t percentile(double percentile) const;
+};
+
+Histogram& histogram(Stage stage);
+
+/*
+Records the elapsed wall time of a scope, in microseconds, into the histogram
+for its stage, and makes it the thread's current stage while it runs.
+*/
+class Timer {
+    Stage stage;
+    Stage previous;
+    std::chrono::steady_clock::time_point start;
+
+   public:
+    explicit Timer(Stage stage);
+    ~Timer();
+
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+};
+
+/*
+The stage of the calling thread's innermost Timer, Stage::COUNT outside of
+any.
+*/
+Stage current_stage();
+
+/*
+Mirror the calling thread's current stage into stage, so another thread can
+see what this one is doing, or stop with nullptr.
+*/
+void share_stage(std::atomic<Stage>* stage);
+
+/*
+Named event counters, reported alongside the histograms.
+*/
+void count(const std::string& name, uint64_t amount = 1);
+uint64_t counter(const std::string& name);
+
+/*
+Human readable table of every stage with samples, used by the overlay.
+*/
+QString summary();
+
+bool write_json(const std::string& path);
+
+/*
+Dump the statistics to PHOTOS_STATS, or stats.json when unset.
+*/
+void finish();
+
+}  // namespace Stats
+
+#define STAGE_SCOPE(stage) \
+    Stats::Timer TRACE_CONCAT(_stage_timer, __LINE__){stage}
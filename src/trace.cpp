@@ -0,0 +1,209 @@
+#include "trace.h"
+
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+
+namespace Trace {
+
+std::atomic<bool> enabled{false};
+
+namespace {
+
+// Events per thread before the oldest start being overwritten
+constexpr uint64_t BUFFER_SIZE = 1 << 14;
+
+const auto epoch = std::chrono::steady_clock::now();
+
+/*
+Single-producer ring buffer. Only the owning thread writes; the exporter reads
+a snapshot and discards anything the writer may have lapped in the meantime.
+*/
+struct Buffer {
+    std::vector<Event> events = std::vector<Event>(BUFFER_SIZE);
+    std::atomic<uint64_t> head{0};
+    uint32_t thread_id = 0;
+    std::string thread_name;
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<Buffer>> buffers;
+    std::string path;
+};
+
+Registry& registry() {
+    static Registry registry;
+    return registry;
+}
+
+struct ThreadState {
+    std::shared_ptr<Buffer> buffer;
+    uint32_t next_id = 1;
+    uint32_t current = 0;
+    uint32_t depth = 0;
+};
+
+thread_local ThreadState state;
+
+Buffer& thread_buffer() {
+    if (!state.buffer) {
+        static std::atomic<uint32_t> next_thread_id{1};
+
+        auto buffer = std::make_shared<Buffer>();
+        buffer->thread_id = next_thread_id.fetch_add(1);
+        buffer->thread_name = "Thread " + std::to_string(buffer->thread_id);
+
+        Registry& registry = Trace::registry();
+        std::lock_guard lock(registry.mutex);
+        registry.buffers.push_back(buffer);
+        state.buffer = std::move(buffer);
+    }
+    return *state.buffer;
+}
+
+void write_escaped(std::ostream& stream, const std::string& string) {
+    stream << '"';
+    for (char c : string) {
+        if (c == '"' || c == '\\') stream << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20) stream << ' ';
+        else stream << c;
+    }
+    stream << '"';
+}
+
+}  // namespace
+
+uint64_t now() {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - epoch
+        ).count()
+    );
+}
+
+void begin(uint32_t& id, uint32_t& parent, uint64_t& start) {
+    thread_buffer();
+    id = state.next_id++;
+    parent = state.current;
+    state.current = id;
+    state.depth++;
+    start = now();
+}
+
+void end(const char* name, uint32_t id, uint32_t parent, uint64_t start) {
+    uint64_t finish = now();
+    Buffer& buffer = thread_buffer();
+
+    if (state.depth > 0) state.depth--;
+    state.current = parent;
+
+    uint64_t head = buffer.head.load(std::memory_order_relaxed);
+    buffer.events[head & (BUFFER_SIZE - 1)] = {
+        name, start, finish - start, id, parent, state.depth
+    };
+    buffer.head.store(head + 1, std::memory_order_release);
+}
+
+void set_thread_name(const std::string& name) {
+    Buffer& buffer = thread_buffer();
+    std::lock_guard lock(registry().mutex);
+    buffer.thread_name = name;
+}
+
+void init() {
+    const char* path = std::getenv("PHOTOS_TRACE");
+    if (!path || !*path) return;
+
+    std::lock_guard lock(registry().mutex);
+    registry().path = path;
+    start();
+}
+
+void start() {
+    enabled.store(true, std::memory_order_relaxed);
+}
+
+void stop() {
+    enabled.store(false, std::memory_order_relaxed);
+}
+
+bool write_json(const std::string& path) {
+    std::ofstream stream(path);
+    if (!stream) {
+        std::cerr << "Failed to open trace file " << path << "\n";
+        return false;
+    }
+
+    std::vector<std::shared_ptr<Buffer>> buffers;
+    {
+        std::lock_guard lock(registry().mutex);
+        buffers = registry().buffers;
+    }
+
+    stream << std::fixed << std::setprecision(3);
+    stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    bool first = true;
+    auto separator = [&]() {
+        if (!first) stream << ",\n";
+        first = false;
+    };
+
+    uint64_t dropped = 0;
+    for (const auto& buffer : buffers) {
+        {
+            std::lock_guard lock(registry().mutex);
+            separator();
+            stream << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,"
+                   << "\"tid\":" << buffer->thread_id << ",\"args\":{\"name\":";
+            write_escaped(stream, buffer->thread_name);
+            stream << "}}";
+        }
+
+        uint64_t head = buffer->head.load(std::memory_order_acquire);
+        uint64_t oldest = head > BUFFER_SIZE ? head - BUFFER_SIZE : 0;
+
+        std::vector<Event> events;
+        events.reserve(head - oldest);
+        for (uint64_t i = oldest; i < head; ++i) {
+            events.push_back(buffer->events[i & (BUFFER_SIZE - 1)]);
+        }
+
+        // Entries the writer lapped while we were copying may be torn,
+        // including the slot of the event it may be writing right now
+        uint64_t after = buffer->head.load(std::memory_order_acquire);
+        uint64_t valid = after >= BUFFER_SIZE ? after - BUFFER_SIZE + 1 : 0;
+        dropped += std::max(oldest, valid);
+
+        for (uint64_t i = std::max(oldest, valid); i < head; ++i) {
+            const Event& event = events[i - oldest];
+            separator();
+            stream << "{\"ph\":\"X\",\"cat\":\"photos\",\"pid\":1,"
+                   << "\"tid\":" << buffer->thread_id << ",\"name\":";
+            write_escaped(stream, event.name);
+            stream << ",\"ts\":" << static_cast<double>(event.start) / 1000.0
+                   << ",\"dur\":" << static_cast<double>(event.duration) / 1000.0
+                   << ",\"args\":{\"id\":" << event.id
+                   << ",\"parent\":" << event.parent
+                   << ",\"depth\":" << event.depth << "}}";
+        }
+    }
+
+    stream << "],\"otherData\":{\"dropped_events\":" << dropped << "}}\n";
+
+    std::cout << "Wrote trace to " << path << "\n";
+    return static_cast<bool>(stream);
+}
+
+void finish() {
+    std::string path;
+    {
+        std::lock_guard lock(registry().mutex);
+        path = registry().path;
+    }
+    if (!path.empty()) write_json(path);
+}
+
+}  // namespace Trace
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "pch.h"
+
+#include <atomic>
+#include <cstdint>
+
+namespace Trace {
+
+/*
+A single completed scope. Names must be string literals (or otherwise outlive
+the trace) since only the pointer is stored.
+*/
+struct Event {
+    const char* name;
+    uint64_t start;
+    uint64_t duration;
+    uint32_t id;
+    uint32_t parent;
+    uint32_t depth;
+};
+
+extern std::atomic<bool> enabled;
+
+uint64_t now();
+
+void begin(uint32_t& id, uint32_t& parent, uint64_t& start);
+
+void end(const char* name, uint32_t id, uint32_t parent, uint64_t start);
+
+/*
+Records a scope into the calling thread's ring buffer. When tracing is
+disabled at runtime the constructor is a single relaxed load.
+*/
+class Scope {
+    const char* name = nullptr;
+    uint64_t start = 0;
+    uint32_t id = 0;
+    uint32_t parent = 0;
+
+   public:
+    explicit Scope(const char* name) {
+        if (!enabled.load(std::memory_order_relaxed)) return;
+        this->name = name;
+        begin(this->id, this->parent, this->start);
+    }
+
+    ~Scope() {
+        if (this->name) end(this->name, this->id, this->parent, this->start);
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+};
+
+void set_thread_name(const std::string& name);
+
+/*
+Reads PHOTOS_TRACE from the environment. If set, tracing starts immediately and
+the trace is written to that path at exit.
+*/
+void init();
+
+/*
+Write the trace requested through PHOTOS_TRACE, if any.
+*/
+void finish();
+
+void start();
+
+void stop();
+
+/*
+Write every buffered event as Chrome trace-event JSON, loadable in
+chrome://tracing or ui.perfetto.dev.
+*/
+bool write_json(const std::string& path);
+
+}  // namespace Trace
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#if ENABLE_TRACING
+    #define TRACE_SCOPE(name) \
+        Trace::Scope TRACE_CONCAT(_trace_scope, __LINE__){name}
+#else
+    #define TRACE_SCOPE(name) ((void)0)
+#endif
@@ -2,17 +2,6 @@
 
 namespace Utils {
 
-Benchmark::Benchmark(const std::string& name) {
-    this->name = name;
-    this->start = std::chrono::high_resolution_clock::now();
-}
-
-Benchmark::~Benchmark() {
-    auto end = std::chrono::high_resolution_clock::now();
-    auto ms = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
-    std::cout << name << " took " << ms << "us\n";
-}
-
 float parse_fraction(const QString& fraction) {
     QStringList parts = fraction.split('/');
     if (parts.size() != 2) {
@@ -136,6 +125,29 @@ std::string from_base64(const std::string& input) {
     return std::string(decoded.constData(), static_cast<std::string::size_type>(decoded.size()));
 }
 
+std::string to_bytes(const QString& text) {
+    std::ostringstream oss;
+    for (char16_t ch : text.toStdU16String()) {
+        oss << static_cast<int>(ch & 0xFF) << ' '
+            << static_cast<int>((ch >> 8) & 0xFF) << ' ';
+    }
+    oss << "0 0";
+    return oss.str();
+}
+
+QString from_bytes(const std::string& input) {
+    std::istringstream iss(input);
+    std::u16string utf16;
+    int low;
+    int high;
+    while (iss >> low >> high) {
+        char16_t ch = static_cast<char16_t>((high & 0xFF) << 8 | (low & 0xFF));
+        if (ch == 0) break;
+        utf16.push_back(ch);
+    }
+    return QString::fromStdU16String(utf16);
+}
+
 QString format_size(qint64 bytes) {
     double size = bytes;
     QStringList units = {"B", "KB", "MB", "GB", "TB"};
@@ -34,15 +34,6 @@
 
 namespace Utils {
 
-class Benchmark {
-    std::string name;
-    std::chrono::high_resolution_clock::time_point start;
-
-   public:
-    Benchmark(const std::string& name);
-    ~Benchmark();
-};
-
 float parse_fraction(const QString& fraction);
 
 double to_decimal(const QStringList& list, const std::string& ref);
@@ -56,6 +47,17 @@ otherwise.
 */
 std::string read_bytes(std::string input);
 
+/*
+Encode text as the decimal byte string Exiv2 expects for UCS-2 tags such as
+Exif.Image.XPTitle, e.g. "72 0 105 0 0 0" for "Hi".
+*/
+std::string to_bytes(const QString& text);
+
+/*
+Decode a decimal UCS-2 byte string written by to_bytes back into text.
+*/
+QString from_bytes(const std::string& input);
+
 
 bool is_base64(const QString& string);
 
@@ -66,9 +68,3 @@ std::string from_base64(const std::string& input);
 QString format_size(qint64 bytes);
 
 }  // namespace Utils
-
-#if ENABLE_BENCHMARKS
-    #define BENCHMARK(name) Utils::Benchmark _timer##__LINE__{name}
-#else
-    #define BENCHMARK(name)
-#endif
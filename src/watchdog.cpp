@@ -0,0 +1,168 @@
+#include "watchdog.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "trace.h"
+
+namespace Watchdog {
+
+namespace {
+
+const size_t SLOTS = static_cast<size_t>(Stats::Stage::COUNT) + 1;
+
+// Stalls this long are reported while still going on
+const std::chrono::seconds REPORT_AFTER{1};
+
+std::chrono::milliseconds default_threshold() {
+    const char* threshold = std::getenv("PHOTOS_STALL_MS");
+    int milliseconds = threshold ? std::atoi(threshold) : 0;
+    return std::chrono::milliseconds(milliseconds > 0 ? milliseconds : 200);
+}
+
+uint64_t microseconds(std::chrono::steady_clock::duration duration) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(duration).count()
+    );
+}
+
+std::array<Stats::Histogram, SLOTS> histograms;
+
+class Monitor {
+   public:
+    void start() {
+        if (this->thread.joinable()) return;
+
+        this->threshold = default_threshold();
+        this->last_beat = std::chrono::steady_clock::now().time_since_epoch().count();
+        Stats::share_stage(&this->stage);
+
+        this->timer = new QTimer(qApp);
+        QObject::connect(this->timer, &QTimer::timeout, [this] {
+            this->last_beat = std::chrono::steady_clock::now().time_since_epoch().count();
+        });
+        this->timer->start(HEARTBEAT);
+
+        this->stopping = false;
+        this->thread = std::thread([this] { this->run(); });
+    }
+
+    void stop() {
+        if (!this->thread.joinable()) return;
+
+        {
+            std::lock_guard lock(this->mutex);
+            this->stopping = true;
+        }
+        this->wake.notify_all();
+        this->thread.join();
+
+        Stats::share_stage(nullptr);
+        delete this->timer;
+        this->timer = nullptr;
+    }
+
+   private:
+    std::chrono::milliseconds threshold;
+    // steady_clock ticks of the latest heartbeat
+    std::atomic<std::chrono::steady_clock::rep> last_beat{0};
+    // Mirrors the GUI thread's current stage
+    std::atomic<Stats::Stage> stage{Stats::Stage::COUNT};
+
+    QTimer* timer = nullptr;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void run() {
+        Trace::set_thread_name("Watchdog");
+
+        using Clock = std::chrono::steady_clock;
+        // Fine enough to attribute stalls of the threshold's length
+        const auto poll = std::max(std::chrono::milliseconds(5), this->threshold / 8);
+
+        // Beat before the stall in progress, if any
+        std::optional<Clock::time_point> stalled_since;
+        std::array<int, SLOTS> samples{};
+        bool reported = false;
+
+        std::unique_lock lock(this->mutex);
+        while (!this->wake.wait_for(lock, poll, [this] { return this->stopping; })) {
+            Clock::time_point beat{Clock::duration(this->last_beat.load())};
+            Clock::time_point now = Clock::now();
+
+            if (stalled_since && beat != *stalled_since) {
+                // Beats resumed; the expected interval is not part of the stall
+                auto duration = beat - *stalled_since - HEARTBEAT;
+                this->record(duration, samples, reported);
+                stalled_since.reset();
+            }
+
+            if (now - beat < this->threshold + HEARTBEAT) continue;
+
+            if (!stalled_since) {
+                stalled_since = beat;
+                samples.fill(0);
+                reported = false;
+            }
+            samples[static_cast<size_t>(this->stage.load(std::memory_order_relaxed))]++;
+
+            if (!reported && now - beat > REPORT_AFTER) {
+                std::cerr << "GUI thread stalled for "
+                          << microseconds(now - beat) / 1000 << " ms so far, in "
+                          << name(dominant(samples)) << "\n";
+                reported = true;
+            }
+        }
+    }
+
+    static size_t dominant(const std::array<int, SLOTS>& samples) {
+        return static_cast<size_t>(
+            std::max_element(samples.begin(), samples.end()) - samples.begin()
+        );
+    }
+
+    static const char* name(size_t slot) {
+        auto stage = static_cast<Stats::Stage>(slot);
+        return stage == Stats::Stage::COUNT ? "no stage" : Stats::stage_name(stage);
+    }
+
+    void record(
+        std::chrono::steady_clock::duration duration,
+        const std::array<int, SLOTS>& samples,
+        bool reported
+    ) {
+        size_t slot = dominant(samples);
+        histograms[slot].record(microseconds(duration));
+        Stats::count("stalls");
+
+        if (reported) {
+            std::cerr << "GUI thread stall ended after "
+                      << microseconds(duration) / 1000 << " ms, mostly in "
+                      << name(slot) << "\n";
+        }
+    }
+};
+
+Monitor& monitor() {
+    static Monitor instance;
+    return instance;
+}
+
+}  // namespace
+
+void start() {
+    monitor().start();
+}
+
+void stop() {
+    monitor().stop();
+}
+
+const Stats::Histogram& stalls(Stats::Stage stage) {
+    return histograms[static_cast<size_t>(stage)];
+}
+
+}  // namespace Watchdog
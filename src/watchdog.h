@@ -0,0 +1,31 @@
+#pragma once
+
+#include "pch.h"
+#include "stats.h"
+
+/*
+Detects stalls of the GUI thread's event loop. A timer on the GUI thread
+beats every HEARTBEAT; a watchdog thread notices when beats stop for longer
+than the threshold (PHOTOS_STALL_MS, 200 by default) and samples which stage
+the GUI thread is in until they resume. Each stall's duration goes into the
+histogram of the stage seen most often during it, and stalls past a second
+are logged as they happen, so a freeze names the code path behind it.
+*/
+namespace Watchdog {
+
+const std::chrono::milliseconds HEARTBEAT{50};
+
+/*
+Call on the GUI thread once its event loop is about to run.
+*/
+void start();
+
+void stop();
+
+/*
+Stall durations in microseconds, by stage; Stage::COUNT holds stalls outside
+of any stage.
+*/
+const Stats::Histogram& stalls(Stats::Stage stage);
+
+}  // namespace Watchdog